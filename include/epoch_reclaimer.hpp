@@ -0,0 +1,388 @@
+#pragma once
+
+#include "masstree/config.h"
+// DO NOT REORDER (config.h needs to be included before other headers)
+#include "masstree/compiler.hh"
+#include "masstree/kvthread.hh"
+#include "numa_placement.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Drives masstree's RCU.
+ * Masstree only frees memory handed to threadinfo::deallocate_rcu() once
+ * active_epoch has moved past the epoch it was retired in, and nothing in
+ * masstree itself advances the epochs. The reclaimer owns a background thread
+ * that bumps globalepoch and publishes the oldest epoch still pinned by a
+ * registered thread as active_epoch; threads free their limbo lists when they
+ * quiesce.
+ */
+class EpochReclaimer {
+public:
+  struct Stats {
+    mrcu_epoch_type global_epoch = 0;
+    mrcu_epoch_type active_epoch = 0;
+    uint64_t advances = 0;
+    uint64_t quiesces = 0;
+    uint64_t retired_bytes = 0;   // handed to RCU by quiesced threads
+    uint64_t reclaimed_bytes = 0; // of which actually freed
+
+    uint64_t pending_bytes() const { return retired_bytes - reclaimed_bytes; }
+  };
+
+  EpochReclaimer() = default;
+  EpochReclaimer(const EpochReclaimer &) = delete;
+  EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+  ~EpochReclaimer() { stop(); }
+
+  void start(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (thread_.joinable())
+      return;
+    stopping_ = false;
+    thread_ = std::thread([this, interval] { run(interval); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      if (!thread_.joinable())
+        return;
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  bool running() const { return thread_.joinable(); }
+
+  // one step of the advancer (same as masstree's own epochinc())
+  static void advance() {
+    std::lock_guard<std::mutex> lk(epoch_mutex());
+    globalepoch += 2;
+    active_epoch = threadinfo::min_active_epoch();
+    counters().advances.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Declares that the calling thread holds no node or value pointer obtained
+   * before this call, and frees whatever its limbo list allows.
+   */
+  static void quiesce(threadinfo &ti) {
+    uint64_t bytes = local_retired_bytes();
+    if (bytes != 0) {
+      local_retired_bytes() = 0;
+      counters().retired_bytes.fetch_add(bytes, std::memory_order_relaxed);
+      // freed in order with everything this thread retired before it
+      ti.rcu_register(new ReclaimMarker(bytes));
+    }
+    ti.rcu_quiesce();
+    counters().quiesces.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // counted against the calling thread until it next quiesces
+  static void note_retired(std::size_t size) { local_retired_bytes() += size; }
+
+  static Stats stats() {
+    Stats s;
+    s.global_epoch = globalepoch;
+    s.active_epoch = active_epoch;
+    s.advances = counters().advances.load(std::memory_order_relaxed);
+    s.quiesces = counters().quiesces.load(std::memory_order_relaxed);
+    s.reclaimed_bytes =
+        counters().reclaimed_bytes.load(std::memory_order_relaxed);
+    s.retired_bytes = counters().retired_bytes.load(std::memory_order_relaxed);
+    return s;
+  }
+
+private:
+  class ReclaimMarker : public rcu_callback {
+  public:
+    explicit ReclaimMarker(uint64_t bytes) : bytes_(bytes) {}
+    void operator()(threadinfo &) override {
+      counters().reclaimed_bytes.fetch_add(bytes_, std::memory_order_relaxed);
+      delete this;
+    }
+
+  private:
+    uint64_t bytes_;
+  };
+
+  struct Counters {
+    alignas(64) std::atomic<uint64_t> advances{0};
+    std::atomic<uint64_t> quiesces{0};
+    alignas(64) std::atomic<uint64_t> retired_bytes{0};
+    std::atomic<uint64_t> reclaimed_bytes{0};
+  };
+
+  static Counters &counters() {
+    static Counters c;
+    return c;
+  }
+
+  // several wrappers may run an advancer; epochs are process-wide
+  static std::mutex &epoch_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  static uint64_t &local_retired_bytes() {
+    thread_local uint64_t bytes = 0;
+    return bytes;
+  }
+
+  void run(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (!cv_.wait_for(lk, interval, [this] { return stopping_; }))
+      advance();
+  }
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+/**
+ * Bytes the trees hold from masstree's allocator, by kind. Every allocation
+ * and free made through reclaim_threadinfo is added to the calling thread's
+ * own counters, so the hot path writes no shared cache line; usage() sums
+ * them over all threads that ever allocated. Pool allocations count in whole
+ * cache lines, and memory handed to RCU counts as freed when it is retired.
+ * Free lines cached in the threadinfo pools are not visible from here: a
+ * line counts while it is in use, not while a pool holds it for reuse.
+ */
+class PoolAccounting {
+public:
+  enum Kind { leaf, internode, ksuffix, value, other };
+  static constexpr int num_kinds = 5;
+
+  struct Usage {
+    int64_t bytes[num_kinds] = {};      // live
+    uint64_t allocations[num_kinds] = {}; // ever made
+
+    int64_t total_bytes() const {
+      int64_t sum = 0;
+      for (int64_t b : bytes)
+        sum += b;
+      return sum;
+    }
+  };
+
+  static const char *name(int kind) {
+    static const char *const names[num_kinds] = {"leaf", "internode",
+                                                  "ksuffix", "value", "other"};
+    return names[kind];
+  }
+
+  static Kind kind_of(memtag tag) {
+    switch (tag) {
+    case memtag_masstree_leaf:
+      return leaf;
+    case memtag_masstree_internode:
+      return internode;
+    case memtag_masstree_ksuffixes:
+      return ksuffix;
+    case memtag_value:
+      return value;
+    default:
+      return other;
+    }
+  }
+
+  static void allocated(memtag tag, std::size_t bytes) {
+    ThreadCounters &c = local();
+    Kind k = kind_of(tag);
+    bump(c.bytes[k], static_cast<int64_t>(bytes));
+    bump(c.allocations[k], uint64_t{1});
+  }
+
+  static void freed(memtag tag, std::size_t bytes) {
+    bump(local().bytes[kind_of(tag)], -static_cast<int64_t>(bytes));
+  }
+
+  static Usage usage() {
+    Usage u;
+    std::lock_guard<std::mutex> lk(registry().mutex);
+    for (const auto &c : registry().threads)
+      for (int k = 0; k < num_kinds; ++k) {
+        u.bytes[k] += c->bytes[k].load(std::memory_order_relaxed);
+        u.allocations[k] += c->allocations[k].load(std::memory_order_relaxed);
+      }
+    return u;
+  }
+
+private:
+  // written by its own thread only
+  struct alignas(64) ThreadCounters {
+    std::atomic<int64_t> bytes[num_kinds] = {};
+    std::atomic<uint64_t> allocations[num_kinds] = {};
+  };
+
+  struct Registry {
+    std::mutex mutex;
+    // kept after their threads exit: what they allocated is still live
+    std::vector<std::unique_ptr<ThreadCounters>> threads;
+  };
+
+  template <typename V> static void bump(std::atomic<V> &c, V delta) {
+    c.store(c.load(std::memory_order_relaxed) + delta,
+            std::memory_order_relaxed);
+  }
+
+  static Registry &registry() {
+    static Registry r;
+    return r;
+  }
+
+  static ThreadCounters &local() {
+    thread_local ThreadCounters *c = [] {
+      std::lock_guard<std::mutex> lk(registry().mutex);
+      registry().threads.emplace_back(new ThreadCounters);
+      return registry().threads.back().get();
+    }();
+    return *c;
+  }
+};
+
+/**
+ * threadinfo as seen by the tree. Masstree reaches the allocator through
+ * P::threadinfo_type, so putting this handle there lets the reclaimer
+ * account every node and key suffix the tree retires, PoolAccounting see
+ * what the tree holds, and internodes come from the InternodeArena once it
+ * is enabled.
+ *
+ * It wraps the thread's masstree threadinfo (which only threadinfo::make()
+ * can create) and forwards the rest of its interface. Masstree's own RCU
+ * callbacks, which collect emptied layers and destroy tables, derive from
+ * threadinfo_type::rcu_callback below and so free through a handle as well;
+ * every allocation and free the tree makes is counted.
+ */
+class reclaim_threadinfo {
+public:
+  explicit reclaim_threadinfo(threadinfo &ti) : ti_(&ti) {}
+
+  // one per thread, kept for the life of the process like its threadinfo
+  static reclaim_threadinfo *make(int purpose, int index) {
+    return new reclaim_threadinfo(*threadinfo::make(purpose, index));
+  }
+
+  operator threadinfo &() const { return *ti_; }
+
+  // called with a handle on the thread that runs it
+  class rcu_callback : public ::rcu_callback {
+  public:
+    virtual void operator()(reclaim_threadinfo &ti) = 0;
+    void operator()(threadinfo &ti) final {
+      reclaim_threadinfo handle(ti);
+      (*this)(handle);
+    }
+  };
+
+  void rcu_register(::rcu_callback *cb) { ti_->rcu_register(cb); }
+  void rcu_start() { ti_->rcu_start(); }
+  void rcu_stop() { ti_->rcu_stop(); }
+  void rcu_quiesce() { ti_->rcu_quiesce(); }
+
+  // counters, fences and the like, passed through as they are; templates so
+  // that whatever this masstree version lacks is simply never instantiated
+  template <typename... A, typename TI = threadinfo>
+  auto mark(A... a) -> decltype(std::declval<TI &>().mark(a...)) {
+    return static_cast<TI &>(*ti_).mark(a...);
+  }
+  template <typename... A, typename TI = threadinfo>
+  auto counter(A... a) const -> decltype(std::declval<TI &>().counter(a...)) {
+    return static_cast<TI &>(*ti_).counter(a...);
+  }
+  template <typename... A, typename TI = threadinfo>
+  auto stable_fence(A... a) const
+      -> decltype(std::declval<TI &>().stable_fence(a...)) {
+    return static_cast<TI &>(*ti_).stable_fence(a...);
+  }
+  template <typename... A, typename TI = threadinfo>
+  auto lock_fence(A... a) const
+      -> decltype(std::declval<TI &>().lock_fence(a...)) {
+    return static_cast<TI &>(*ti_).lock_fence(a...);
+  }
+  template <typename... A, typename TI = threadinfo>
+  auto operation_timestamp(A... a) const
+      -> decltype(std::declval<TI &>().operation_timestamp(a...)) {
+    return static_cast<TI &>(*ti_).operation_timestamp(a...);
+  }
+  int purpose() const { return ti_->purpose(); }
+  int index() const { return ti_->index(); }
+  mrcu_epoch_type gc_epoch() const { return ti_->gc_epoch(); }
+
+  // passes on masstree's optional alignment argument
+  template <typename... Align>
+  void *allocate(std::size_t sz, memtag tag, Align... align) {
+    PoolAccounting::allocated(tag, sz);
+    return ti_->allocate(sz, tag, align...);
+  }
+
+  void deallocate(void *p, std::size_t sz, memtag tag) {
+    PoolAccounting::freed(tag, sz);
+    ti_->deallocate(p, sz, tag);
+  }
+
+  void deallocate_rcu(void *p, std::size_t sz, memtag tag) {
+    ti_->deallocate_rcu(p, sz, tag);
+    EpochReclaimer::note_retired(sz);
+    PoolAccounting::freed(tag, sz);
+  }
+
+  void *pool_allocate(std::size_t sz, memtag tag) {
+    PoolAccounting::allocated(tag, lines(sz));
+    if (tag == memtag_masstree_internode && InternodeArena::get().enabled())
+      if (void *p = InternodeArena::get().allocate(sz))
+        return p;
+    return ti_->pool_allocate(sz, tag);
+  }
+
+  void pool_deallocate(void *p, std::size_t sz, memtag tag) {
+    PoolAccounting::freed(tag, lines(sz));
+    if (InternodeArena::get().owns(p))
+      InternodeArena::get().deallocate(p, sz);
+    else
+      ti_->pool_deallocate(p, sz, tag);
+  }
+
+  void pool_deallocate_rcu(void *p, std::size_t sz, memtag tag) {
+    // masstree would put arena blocks back into this thread's pools
+    if (InternodeArena::get().owns(p))
+      ti_->rcu_register(new ArenaRelease(p, sz));
+    else
+      ti_->pool_deallocate_rcu(p, sz, tag);
+    EpochReclaimer::note_retired(lines(sz));
+    PoolAccounting::freed(tag, lines(sz));
+  }
+
+private:
+  // pools hand out whole cache lines
+  static std::size_t lines(std::size_t sz) {
+    return (sz + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  }
+
+  class ArenaRelease : public ::rcu_callback {
+  public:
+    ArenaRelease(void *p, std::size_t sz) : p_(p), sz_(sz) {}
+    void operator()(threadinfo &) override {
+      InternodeArena::get().deallocate(p_, sz_);
+      delete this;
+    }
+
+  private:
+    void *p_;
+    std::size_t sz_;
+  };
+
+  threadinfo *ti_;
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <type_traits>
+
+#include "masstree_wrapper.hpp"
+
+/**
+ * Keeps values in the leaf's value slot itself instead of behind a T *, so a
+ * successful get costs no extra dependent miss and callers need not keep
+ * values alive outside the tree. A slot is one machine word; the codec
+ * decides how a value maps onto it.
+ */
+template <typename Codec>
+class EncodedMasstreeWrapper : private MasstreeWrapper<typename Codec::Slot> {
+  using Base = MasstreeWrapper<typename Codec::Slot>;
+  using Slot = typename Codec::Slot;
+
+public:
+  using value_type = typename Codec::value_type;
+  using Str = typename Base::Str;
+  using leaf_type = typename Base::leaf_type;
+
+  using Base::count_range;
+  using Base::dump_latency;
+  using Base::estimate_range;
+  using Base::latency_histograms;
+  using Base::quiesce;
+  using Base::reclaim_stats;
+  using Base::reset_latency;
+  using Base::interleave_internodes;
+  using Base::start_reclamation;
+  using Base::stats;
+  using Base::stop_reclamation;
+  using Base::thread_init;
+  using Base::thread_offline;
+
+  bool insert_value(const char *key, std::size_t len_key,
+                    const value_type &value) {
+    Slot *slot = Codec::encode(value, *Base::ti);
+    if (Base::insert_value(key, len_key, slot))
+      return 1;
+    Codec::discard(slot, *Base::ti); // never published
+    return 0;
+  }
+
+  std::optional<value_type> get_value(const char *key, std::size_t len_key) {
+    Slot *slot = nullptr;
+    if (!Base::find_value(key, len_key, slot))
+      return std::nullopt;
+    return Codec::decode(slot);
+  }
+
+  bool update_value(const char *key, std::size_t len_key,
+                    const value_type &value) {
+    Slot *slot = Codec::encode(value, *Base::ti);
+    Slot *old_slot = nullptr;
+    if (Base::update_value_and_get_old(key, len_key, slot, old_slot)) {
+      Codec::retire(old_slot, *Base::ti);
+      return 1;
+    }
+    Codec::discard(slot, *Base::ti);
+    return 0;
+  }
+
+  bool remove_value(const char *key, std::size_t len_key) {
+    Slot *old_slot = nullptr;
+    if (!Base::remove_value_and_get_old(key, len_key, old_slot))
+      return 0;
+    Codec::retire(old_slot, *Base::ti);
+    return 1;
+  }
+
+  // returns 1 if the key was inserted, 0 if its value was replaced
+  bool upsert(const char *key, std::size_t len_key, const value_type &value) {
+    Slot *slot = Codec::encode(value, *Base::ti);
+    Slot *old_slot = nullptr;
+    if (Base::upsert_and_get_old(key, len_key, slot, old_slot))
+      return 1;
+    Codec::retire(old_slot, *Base::ti);
+    return 0;
+  }
+
+  // current: value if it was inserted (returns 1), else the existing value
+  bool insert_or_get(const char *key, std::size_t len_key,
+                     const value_type &value, value_type &current) {
+    Slot *slot = Codec::encode(value, *Base::ti);
+    Slot *current_slot = nullptr;
+    bool inserted = Base::insert_or_get(key, len_key, slot, current_slot);
+    if (!inserted)
+      Codec::discard(slot, *Base::ti);
+    current = Codec::decode(current_slot);
+    return inserted;
+  }
+
+  // values are compared with value_type's operator==
+  bool compare_and_swap(const char *key, std::size_t len_key,
+                        const value_type &expected,
+                        const value_type &desired) {
+    Slot *slot = Codec::encode(desired, *Base::ti);
+    Slot *old_slot = nullptr;
+    bool swapped = Base::read_modify_write(
+        key, len_key, [&](bool found, Slot *&current) {
+          if (!found || !(Codec::decode(current) == expected))
+            return false;
+          old_slot = current;
+          current = slot;
+          return true;
+        });
+    if (swapped)
+      Codec::retire(old_slot, *Base::ti);
+    else
+      Codec::discard(slot, *Base::ti);
+    return swapped;
+  }
+
+  /**
+   * Calls bool fn(bool found, value_type &value) with the key's leaf locked;
+   * value is the current value, or value_type() if the key is absent. If fn
+   * returns true, value is stored (inserting the key if needed). fn must not
+   * call into the wrapper.
+   */
+  template <typename F>
+  bool read_modify_write(const char *key, std::size_t len_key, F &&fn) {
+    Slot *old_slot = nullptr;
+    bool stored = Base::read_modify_write(
+        key, len_key, [&](bool found, Slot *&current) {
+          value_type value = found ? Codec::decode(current) : value_type();
+          if (!fn(found, value))
+            return false;
+          old_slot = found ? current : nullptr;
+          current = Codec::encode(value, *Base::ti);
+          return true;
+        });
+    if (old_slot != nullptr)
+      Codec::retire(old_slot, *Base::ti);
+    return stored;
+  }
+
+  /**
+   * Same as MasstreeWrapper::scan, but the visitor's per_kv receives the
+   * decoded value: void per_kv(const Str &, const value_type &, bool &).
+   */
+  template <typename Visitor>
+  void scan(const char *const lkey, const std::size_t len_lkey,
+            const bool l_exclusive, const char *const rkey,
+            const std::size_t len_rkey, const bool r_exclusive,
+            Visitor &&visitor, int64_t max_scan_num = -1) {
+    DecodingVisitor<std::remove_reference_t<Visitor>> dv{visitor};
+    Base::scan(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive, dv,
+               max_scan_num);
+  }
+
+  template <typename Visitor>
+  void rscan(const char *const lkey, const std::size_t len_lkey,
+             const bool l_exclusive, const char *const rkey,
+             const std::size_t len_rkey, const bool r_exclusive,
+             Visitor &&visitor, int64_t max_scan_num = -1) {
+    DecodingVisitor<std::remove_reference_t<Visitor>> dv{visitor};
+    Base::rscan(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive, dv,
+                max_scan_num);
+  }
+
+private:
+  template <typename Visitor> struct DecodingVisitor {
+    Visitor &visitor;
+
+    void per_kv(const Str &key, const Slot *slot, bool &continue_flag) {
+      visitor.per_kv(key, Codec::decode(slot), continue_flag);
+    }
+
+    // only seen by the scanner when the visitor has one
+    template <typename V = Visitor>
+    auto per_node(const leaf_type *leaf, uint64_t version, bool &continue_flag)
+        -> decltype(std::declval<V &>().per_node(leaf, version,
+                                                 continue_flag)) {
+      return visitor.per_node(leaf, version, continue_flag);
+    }
+  };
+};
+
+// trivially copyable values of up to 8 bytes, stored bit for bit
+template <typename T> struct InlineCodec {
+  static_assert(std::is_trivially_copyable<T>::value &&
+                    std::is_default_constructible<T>::value,
+                "inline values must be trivially copyable");
+  static_assert(sizeof(T) <= sizeof(uintptr_t),
+                "inline values must fit in a value slot");
+
+  struct Slot;
+  using value_type = T;
+
+  static Slot *encode(const T &value, reclaim_threadinfo &) {
+    uintptr_t word = 0;
+    memcpy(&word, &value, sizeof(T));
+    return reinterpret_cast<Slot *>(word);
+  }
+
+  static T decode(const Slot *slot) {
+    uintptr_t word = reinterpret_cast<uintptr_t>(slot);
+    T value;
+    memcpy(&value, &word, sizeof(T));
+    return value;
+  }
+
+  static void discard(Slot *, reclaim_threadinfo &) {}
+  static void retire(Slot *, reclaim_threadinfo &) {}
+};
+
+template <typename T>
+using InlineMasstreeWrapper = EncodedMasstreeWrapper<InlineCodec<T>>;
+
+// a byte string of up to 16 bytes
+class SmallValue {
+public:
+  static constexpr std::size_t max_size = 16;
+
+  SmallValue() = default;
+  SmallValue(const void *data, std::size_t size)
+      : size_(static_cast<uint8_t>(size)) {
+    assert(size <= max_size);
+    memcpy(data_, data, size);
+  }
+
+  const char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+  bool operator==(const SmallValue &other) const {
+    return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+  }
+  bool operator!=(const SmallValue &other) const { return !(*this == other); }
+
+private:
+  uint8_t size_ = 0;
+  char data_[max_size] = {};
+};
+
+/**
+ * Tagged slot for SmallValue. Low bit set: the value is inline, bits 1-3 hold
+ * its length (up to 7) and bytes 1-7 its payload. Low bit clear: the slot
+ * points to a SmallValue cell allocated from the threadinfo, which goes back
+ * through RCU when the value is replaced or removed.
+ */
+struct SmallValueCodec {
+  struct Slot;
+  using value_type = SmallValue;
+
+  static constexpr std::size_t max_inline_size = sizeof(uintptr_t) - 1;
+
+  static Slot *encode(const SmallValue &value, reclaim_threadinfo &ti) {
+    if (value.size() <= max_inline_size) {
+      uintptr_t word = 1 | (value.size() << 1);
+      for (std::size_t i = 0; i < value.size(); ++i)
+        word |= static_cast<uintptr_t>(static_cast<uint8_t>(value.data()[i]))
+                << (8 * (i + 1));
+      return reinterpret_cast<Slot *>(word);
+    }
+    void *cell = ti.allocate(sizeof(SmallValue), memtag_value);
+    return reinterpret_cast<Slot *>(new (cell) SmallValue(value));
+  }
+
+  static SmallValue decode(const Slot *slot) {
+    uintptr_t word = reinterpret_cast<uintptr_t>(slot);
+    if (!is_inline(word))
+      return *reinterpret_cast<const SmallValue *>(slot);
+    char data[max_inline_size];
+    std::size_t size = (word >> 1) & 7;
+    for (std::size_t i = 0; i < size; ++i)
+      data[i] = static_cast<char>(word >> (8 * (i + 1)));
+    return SmallValue(data, size);
+  }
+
+  static void discard(Slot *slot, reclaim_threadinfo &ti) {
+    if (!is_inline(reinterpret_cast<uintptr_t>(slot)))
+      ti.deallocate(slot, sizeof(SmallValue), memtag_value);
+  }
+
+  static void retire(Slot *slot, reclaim_threadinfo &ti) {
+    if (!is_inline(reinterpret_cast<uintptr_t>(slot)))
+      ti.deallocate_rcu(slot, sizeof(SmallValue), memtag_value);
+  }
+
+private:
+  static bool is_inline(uintptr_t word) { return word & 1; }
+};
+
+using SmallValueMasstreeWrapper = EncodedMasstreeWrapper<SmallValueCodec>;
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "masstree_wrapper.hpp"
+
+/**
+ * Order-preserving encoding of fixed-width integer keys: big-endian, with the
+ * sign bit flipped for signed types, so memcmp order equals numeric order;
+ * bool takes one byte. Tuples concatenate their fields. The width is a
+ * compile-time constant.
+ */
+template <typename Key, typename = void> struct IntKeyCodec;
+
+template <typename I>
+struct IntKeyCodec<I, std::enable_if_t<std::is_integral<I>::value &&
+                                       !std::is_same<I, bool>::value>> {
+  using unsigned_type = std::make_unsigned_t<I>;
+  static constexpr std::size_t size = sizeof(I);
+
+  static void encode(I key, char *out) {
+    unsigned_type u = static_cast<unsigned_type>(key);
+    if (std::is_signed<I>::value)
+      u ^= unsigned_type(1) << (8 * size - 1);
+    u = to_big_endian(u);
+    memcpy(out, &u, size);
+  }
+
+  static I decode(const char *in) {
+    unsigned_type u;
+    memcpy(&u, in, size);
+    u = to_big_endian(u);
+    if (std::is_signed<I>::value)
+      u ^= unsigned_type(1) << (8 * size - 1);
+    return static_cast<I>(u);
+  }
+
+private:
+  static unsigned_type to_big_endian(unsigned_type u) {
+    if constexpr (size == 8)
+      return __builtin_bswap64(u);
+    else if constexpr (size == 4)
+      return __builtin_bswap32(u);
+    else if constexpr (size == 2)
+      return __builtin_bswap16(u);
+    else
+      return u;
+  }
+};
+
+// one byte, false before true
+template <> struct IntKeyCodec<bool> {
+  static constexpr std::size_t size = 1;
+
+  static void encode(bool key, char *out) { *out = key ? 1 : 0; }
+  static bool decode(const char *in) { return *in != 0; }
+};
+
+template <typename... Is> struct IntKeyCodec<std::tuple<Is...>> {
+  static constexpr std::size_t size = (IntKeyCodec<Is>::size + ... + 0);
+
+  static void encode(const std::tuple<Is...> &key, char *out) {
+    encode_fields(key, out, std::index_sequence_for<Is...>());
+  }
+
+  static std::tuple<Is...> decode(const char *in) {
+    return decode_fields(in, std::index_sequence_for<Is...>());
+  }
+
+private:
+  template <std::size_t I> static constexpr std::size_t offset() {
+    constexpr std::size_t sizes[] = {IntKeyCodec<Is>::size..., 0};
+    std::size_t off = 0;
+    for (std::size_t i = 0; i < I; ++i)
+      off += sizes[i];
+    return off;
+  }
+
+  template <std::size_t... I>
+  static void encode_fields(const std::tuple<Is...> &key, char *out,
+                            std::index_sequence<I...>) {
+    (IntKeyCodec<Is>::encode(std::get<I>(key), out + offset<I>()), ...);
+  }
+
+  template <std::size_t... I>
+  static std::tuple<Is...> decode_fields(const char *in,
+                                         std::index_sequence<I...>) {
+    return std::tuple<Is...>(IntKeyCodec<Is>::decode(in + offset<I>())...);
+  }
+};
+
+/**
+ * MasstreeWrapper keyed by an integer or a tuple of integers. Keys are
+ * encoded into a stack buffer of compile-time width (a single load and bswap
+ * for masstree to turn into an ikey), and scan visitors get the decoded key:
+ *   void per_kv(const Key &key, const T *val, bool &continue_flag);
+ *   void per_node(const leaf_type *, uint64_t, bool &); // optional
+ */
+template <typename T, typename Key>
+class IntKeyMasstreeWrapper : private MasstreeWrapper<T> {
+  using Base = MasstreeWrapper<T>;
+  using Codec = IntKeyCodec<Key>;
+
+public:
+  using key_type = Key;
+  using Str = typename Base::Str;
+  using leaf_type = typename Base::leaf_type;
+  using node_info_t = typename Base::node_info_t;
+  static constexpr std::size_t key_size = Codec::size;
+
+  using Base::dump_latency;
+  using Base::latency_histograms;
+  using Base::quiesce;
+  using Base::reclaim_stats;
+  using Base::reset_latency;
+  using Base::interleave_internodes;
+  using Base::start_reclamation;
+  using Base::stats;
+  using Base::stop_reclamation;
+  using Base::thread_init;
+  using Base::thread_offline;
+
+  bool insert_value(const Key &key, T *value) {
+    KeyBuf buf(key);
+    return Base::insert_value(buf.data, key_size, value);
+  }
+
+  T *get_value(const Key &key) {
+    KeyBuf buf(key);
+    return Base::get_value(buf.data, key_size);
+  }
+
+  bool update_value(const Key &key, T *value) {
+    KeyBuf buf(key);
+    return Base::update_value(buf.data, key_size, value);
+  }
+
+  bool remove_value(const Key &key) {
+    KeyBuf buf(key);
+    return Base::remove_value(buf.data, key_size);
+  }
+
+  template <typename Visitor>
+  void scan(const Key &lkey, const bool l_exclusive, const Key &rkey,
+            const bool r_exclusive, Visitor &&visitor,
+            int64_t max_scan_num = -1) {
+    KeyBuf lbuf(lkey);
+    KeyBuf rbuf(rkey);
+    DecodingVisitor<std::remove_reference_t<Visitor>> dv{visitor};
+    Base::scan(lbuf.data, key_size, l_exclusive, rbuf.data, key_size,
+               r_exclusive, dv, max_scan_num);
+  }
+
+  template <typename Visitor>
+  void rscan(const Key &lkey, const bool l_exclusive, const Key &rkey,
+             const bool r_exclusive, Visitor &&visitor,
+             int64_t max_scan_num = -1) {
+    KeyBuf lbuf(lkey);
+    KeyBuf rbuf(rkey);
+    DecodingVisitor<std::remove_reference_t<Visitor>> dv{visitor};
+    Base::rscan(lbuf.data, key_size, l_exclusive, rbuf.data, key_size,
+                r_exclusive, dv, max_scan_num);
+  }
+
+  std::size_t count_range(const Key &lkey, const bool l_exclusive,
+                          const Key &rkey, const bool r_exclusive) {
+    KeyBuf lbuf(lkey);
+    KeyBuf rbuf(rkey);
+    return Base::count_range(lbuf.data, key_size, l_exclusive, rbuf.data,
+                             key_size, r_exclusive);
+  }
+
+  std::size_t estimate_range(const Key &lkey, const bool l_exclusive,
+                             const Key &rkey, const bool r_exclusive) {
+    KeyBuf lbuf(lkey);
+    KeyBuf rbuf(rkey);
+    return Base::estimate_range(lbuf.data, key_size, l_exclusive, rbuf.data,
+                                key_size, r_exclusive);
+  }
+
+  std::size_t remove_range(const Key &lkey, const bool l_exclusive,
+                           const Key &rkey, const bool r_exclusive) {
+    KeyBuf lbuf(lkey);
+    KeyBuf rbuf(rkey);
+    return Base::remove_range(lbuf.data, key_size, l_exclusive, rbuf.data,
+                              key_size, r_exclusive);
+  }
+
+private:
+  struct KeyBuf {
+    explicit KeyBuf(const Key &key) { Codec::encode(key, data); }
+    char data[key_size];
+  };
+
+  template <typename Visitor> struct DecodingVisitor {
+    Visitor &visitor;
+
+    void per_kv(const Str &key, const T *val, bool &continue_flag) {
+      assert(static_cast<std::size_t>(key.len) == key_size);
+      visitor.per_kv(Codec::decode(key.s), val, continue_flag);
+    }
+
+    // only seen by the scanner when the visitor has one
+    template <typename V = Visitor>
+    auto per_node(const leaf_type *leaf, uint64_t version, bool &continue_flag)
+        -> decltype(std::declval<V &>().per_node(leaf, version,
+                                                 continue_flag)) {
+      return visitor.per_node(leaf, version, continue_flag);
+    }
+  };
+};
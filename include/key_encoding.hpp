@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Order-preserving encoding of composite keys into bytes that sort with
+ * memcmp the way the values sort, so that scan() ranges follow value order.
+ *   integers  big-endian at their own width, the sign bit flipped if signed
+ *   floats    IEEE bits, all flipped if negative, else the sign bit flipped;
+ *             -0.0 is stored as 0.0, and every NaN as the positive quiet
+ *             NaN, which sorts after +infinity
+ *   strings   each 0x00 byte written as 0x00 0xff, then a 0x00 0x01
+ *             terminator, so a string sorts before its extensions
+ *   fixed     a string padded with 0x00 to a given width, no terminator
+ *   tuples    their fields one after another
+ * Every field ends where its own bytes say, so a tuple sorts field by field
+ * and the encoding of a tuple prefix is a prefix of the whole key's.
+ *
+ * KeyEncoder writes into a buffer inside itself, on the caller's stack;
+ * nothing is allocated. A key that does not fit leaves ok() false and must
+ * not be used. KeyDecoder reads the fields back in the same order.
+ */
+
+namespace key_encoding {
+
+template <typename U> inline U to_big_endian(U u) {
+  if constexpr (sizeof(U) == 8)
+    return __builtin_bswap64(u);
+  else if constexpr (sizeof(U) == 4)
+    return __builtin_bswap32(u);
+  else if constexpr (sizeof(U) == 2)
+    return __builtin_bswap16(u);
+  else
+    return u;
+}
+
+template <typename F>
+using float_bits_t = std::conditional_t<sizeof(F) == 8, uint64_t, uint32_t>;
+
+template <typename T>
+constexpr bool is_string_v =
+    std::is_convertible<const T &, std::string_view>::value;
+
+template <typename T> struct is_tuple : std::false_type {};
+template <typename... Ts>
+struct is_tuple<std::tuple<Ts...>> : std::true_type {};
+
+constexpr unsigned char escape = 0x00;
+constexpr unsigned char escaped_zero = 0xff;
+constexpr unsigned char terminator = 0x01;
+
+} // namespace key_encoding
+
+template <std::size_t Capacity = 128> class KeyEncoder {
+public:
+  KeyEncoder() = default;
+
+  template <typename... Fields> explicit KeyEncoder(const Fields &...fields) {
+    (add(fields), ...);
+  }
+
+  // an integer, a float, a string (escaped) or a tuple of these
+  template <typename V> KeyEncoder &add(const V &v) {
+    if constexpr (std::is_same<V, bool>::value) {
+      put_byte(v ? 1 : 0);
+    } else if constexpr (std::is_integral<V>::value) {
+      using U = std::make_unsigned_t<V>;
+      U u = static_cast<U>(v);
+      if (std::is_signed<V>::value)
+        u ^= U(1) << (8 * sizeof(U) - 1);
+      put_word(u);
+    } else if constexpr (std::is_floating_point<V>::value) {
+      static_assert(sizeof(V) == 4 || sizeof(V) == 8, "float or double");
+      using U = key_encoding::float_bits_t<V>;
+      V f = v == 0 ? V(0) : v; // -0.0 and 0.0 are the same key
+      if (v != v) // every NaN, whatever its sign and payload
+        f = std::numeric_limits<V>::quiet_NaN();
+      U u;
+      memcpy(&u, &f, sizeof(u));
+      constexpr U sign = U(1) << (8 * sizeof(U) - 1);
+      put_word((u & sign) ? U(~u) : U(u | sign));
+    } else if constexpr (key_encoding::is_string_v<V>) {
+      add_string(std::string_view(v));
+    } else if constexpr (key_encoding::is_tuple<V>::value) {
+      std::apply([this](const auto &...f) { (add(f), ...); }, v);
+    } else {
+      static_assert(sizeof(V) == 0, "no key encoding for this type");
+    }
+    return *this;
+  }
+
+  // s in exactly width bytes, padded with 0x00; longer strings do not fit
+  KeyEncoder &add_fixed(std::string_view s, std::size_t width) {
+    if (s.size() > width || !reserve(width))
+      return fail();
+    memcpy(buf_ + len_, s.data(), s.size());
+    memset(buf_ + len_ + s.size(), 0, width - s.size());
+    len_ += width;
+    return *this;
+  }
+
+  // the bytes as they are, e.g. a key encoded elsewhere
+  KeyEncoder &add_raw(const char *s, std::size_t n) {
+    if (!reserve(n))
+      return fail();
+    memcpy(buf_ + len_, s, n);
+    len_ += n;
+    return *this;
+  }
+
+  const char *data() const { return buf_; }
+  std::size_t size() const { return len_; }
+  std::string_view view() const { return std::string_view(buf_, len_); }
+  bool ok() const { return ok_; }
+  static constexpr std::size_t capacity() { return Capacity; }
+
+  void clear() {
+    len_ = 0;
+    ok_ = true;
+  }
+
+  // back to the first n bytes, e.g. to reuse a tuple prefix
+  void truncate(std::size_t n) {
+    if (n < len_)
+      len_ = n;
+  }
+
+  /**
+   * Makes this the smallest key greater than every key it is a prefix of:
+   * the last byte below 0xff is incremented and the rest dropped. False if
+   * there is no such key (every byte is 0xff, or the key is empty), and
+   * the range above this prefix has no upper end.
+   */
+  bool to_prefix_successor() {
+    while (len_ > 0 && static_cast<unsigned char>(buf_[len_ - 1]) == 0xff)
+      --len_;
+    if (len_ == 0)
+      return 0;
+    buf_[len_ - 1] = static_cast<char>(
+        static_cast<unsigned char>(buf_[len_ - 1]) + 1);
+    return 1;
+  }
+
+private:
+  bool reserve(std::size_t n) { return ok_ && Capacity - len_ >= n; }
+
+  KeyEncoder &fail() {
+    ok_ = false;
+    return *this;
+  }
+
+  void put_byte(unsigned char c) {
+    if (!reserve(1)) {
+      fail();
+      return;
+    }
+    buf_[len_++] = static_cast<char>(c);
+  }
+
+  template <typename U> void put_word(U u) {
+    if (!reserve(sizeof(U))) {
+      fail();
+      return;
+    }
+    u = key_encoding::to_big_endian(u);
+    memcpy(buf_ + len_, &u, sizeof(U));
+    len_ += sizeof(U);
+  }
+
+  void add_string(std::string_view s) {
+    for (;;) {
+      const char *zero =
+          static_cast<const char *>(memchr(s.data(), 0, s.size()));
+      std::size_t run = zero ? zero - s.data() : s.size();
+      if (!reserve(run + 2)) {
+        fail();
+        return;
+      }
+      memcpy(buf_ + len_, s.data(), run);
+      len_ += run;
+      buf_[len_++] = static_cast<char>(key_encoding::escape);
+      if (zero == nullptr) {
+        buf_[len_++] = static_cast<char>(key_encoding::terminator);
+        return;
+      }
+      buf_[len_++] = static_cast<char>(key_encoding::escaped_zero);
+      s.remove_prefix(run + 1);
+    }
+  }
+
+  char buf_[Capacity];
+  std::size_t len_ = 0;
+  bool ok_ = true;
+};
+
+/**
+ * Reads the fields of an encoded key back, in the order they were added.
+ * Each read returns 0 and leaves the value alone if the bytes left do not
+ * hold a field of that type.
+ */
+class KeyDecoder {
+public:
+  KeyDecoder(const char *data, std::size_t len) : p_(data), end_(data + len) {}
+  explicit KeyDecoder(std::string_view key)
+      : KeyDecoder(key.data(), key.size()) {}
+
+  template <typename V> bool read(V &v) {
+    if constexpr (std::is_same<V, bool>::value) {
+      if (p_ == end_)
+        return 0;
+      v = *p_++ != 0;
+      return 1;
+    } else if constexpr (std::is_integral<V>::value) {
+      using U = std::make_unsigned_t<V>;
+      U u;
+      if (!get_word(u))
+        return 0;
+      if (std::is_signed<V>::value)
+        u ^= U(1) << (8 * sizeof(U) - 1);
+      v = static_cast<V>(u);
+      return 1;
+    } else if constexpr (std::is_floating_point<V>::value) {
+      using U = key_encoding::float_bits_t<V>;
+      U u;
+      if (!get_word(u))
+        return 0;
+      constexpr U sign = U(1) << (8 * sizeof(U) - 1);
+      u = (u & sign) ? U(u ^ sign) : U(~u);
+      memcpy(&v, &u, sizeof(v));
+      return 1;
+    } else if constexpr (std::is_same<V, std::string>::value) {
+      std::string s;
+      if (!read_string([&s](const char *b, std::size_t n) {
+            s.append(b, n);
+            return 1;
+          }))
+        return 0;
+      v = std::move(s);
+      return 1;
+    } else if constexpr (key_encoding::is_tuple<V>::value) {
+      V t;
+      if (!std::apply([this](auto &...f) { return (read(f) && ...); }, t))
+        return 0;
+      v = std::move(t);
+      return 1;
+    } else {
+      static_assert(sizeof(V) == 0, "no key decoding for this type");
+    }
+  }
+
+  // a string into out (at most cap bytes), without allocating
+  bool read(char *out, std::size_t cap, std::size_t &len) {
+    std::size_t n = 0;
+    if (!read_string([&](const char *b, std::size_t k) {
+          if (cap - n < k)
+            return 0;
+          memcpy(out + n, b, k);
+          n += k;
+          return 1;
+        }))
+      return 0;
+    len = n;
+    return 1;
+  }
+
+  // a field written by add_fixed(), padding included
+  bool read_fixed(std::string_view &s, std::size_t width) {
+    if (static_cast<std::size_t>(end_ - p_) < width)
+      return 0;
+    s = std::string_view(p_, width);
+    p_ += width;
+    return 1;
+  }
+
+  bool done() const { return p_ == end_; }
+  std::size_t remaining() const { return end_ - p_; }
+
+private:
+  template <typename U> bool get_word(U &u) {
+    if (static_cast<std::size_t>(end_ - p_) < sizeof(U))
+      return 0;
+    memcpy(&u, p_, sizeof(U));
+    u = key_encoding::to_big_endian(u);
+    p_ += sizeof(U);
+    return 1;
+  }
+
+  // hands the unescaped runs of the next string to put; 0 if malformed
+  template <typename Put> bool read_string(Put &&put) {
+    const char *p = p_;
+    for (;;) {
+      const char *zero = static_cast<const char *>(memchr(p, 0, end_ - p));
+      if (zero == nullptr || zero + 1 == end_)
+        return 0;
+      unsigned char c = static_cast<unsigned char>(zero[1]);
+      if (c != key_encoding::terminator && c != key_encoding::escaped_zero)
+        return 0;
+      if (!put(p, zero - p))
+        return 0;
+      p = zero + 2;
+      if (c == key_encoding::terminator)
+        break;
+      if (!put("", 1))
+        return 0;
+    }
+    p_ = p;
+    return 1;
+  }
+
+  const char *p_;
+  const char *end_;
+};
+
+/**
+ * The scan() arguments for every key that starts with a tuple prefix, or
+ * for the keys from one prefix through another: lkey is the low prefix
+ * itself (inclusive) and rkey the high prefix's successor (exclusive), or
+ * no upper end when there is none.
+ *   KeyPrefixRange<> r(KeyEncoder<>(tenant, std::string_view("orders")));
+ *   mt.scan(r.lkey(), r.len_lkey(), r.l_exclusive(), r.rkey(), r.len_rkey(),
+ *           r.r_exclusive(), visitor);
+ * The same arguments fit count_range() and remove_range().
+ */
+template <std::size_t Capacity = 128> class KeyPrefixRange {
+public:
+  explicit KeyPrefixRange(const KeyEncoder<Capacity> &prefix)
+      : KeyPrefixRange(prefix, prefix) {}
+
+  KeyPrefixRange(const KeyEncoder<Capacity> &lo,
+                 const KeyEncoder<Capacity> &hi)
+      : lo_(lo), hi_(hi), ok_(lo.ok() && hi.ok()) {
+    hi_open_ = !hi_.to_prefix_successor();
+  }
+
+  const char *lkey() const { return lo_.data(); }
+  std::size_t len_lkey() const { return lo_.size(); }
+  bool l_exclusive() const { return 0; }
+  const char *rkey() const { return hi_open_ ? nullptr : hi_.data(); }
+  std::size_t len_rkey() const { return hi_open_ ? 0 : hi_.size(); }
+  bool r_exclusive() const { return 1; }
+
+  // false if either prefix did not fit its encoder
+  bool ok() const { return ok_; }
+
+  // whether key falls in the range; what a scan visitor would be given
+  bool contains(const char *key, std::size_t len) const {
+    std::string_view k(key, len);
+    return k >= lo_.view() && (hi_open_ || k < hi_.view());
+  }
+
+private:
+  KeyEncoder<Capacity> lo_;
+  KeyEncoder<Capacity> hi_;
+  bool hi_open_ = false;
+  bool ok_;
+};
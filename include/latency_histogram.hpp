@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Per-operation latency recording, compiled in with MASSTREE_WRAPPER_LATENCY
+ * (cmake -DMASSTREEWRAPPER_LATENCY=ON). Without it MASSTREE_WRAPPER_TIME_OP
+ * expands to nothing and the wrapper's operations carry no timing code.
+ */
+enum class LatencyOp { get, insert, update, remove, scan };
+constexpr std::size_t num_latency_ops = 5;
+
+/**
+ * Log-linear (HDR-style) histogram of nanosecond latencies: each power of two
+ * is split into 16 buckets, so a bucket is within 1/16 of its values. It has a
+ * single writer; readers may run concurrently and see a slightly stale count.
+ */
+class LatencyHistogram {
+public:
+  static constexpr int sub_bucket_bits = 4;
+  static constexpr int sub_buckets = 1 << sub_bucket_bits;
+  static constexpr int num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram &other) { merge(other); }
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  void record(uint64_t ns) {
+    bump(counts_[bucket_of(ns)], 1);
+    bump(count_, 1);
+    if (ns > max_.load(std::memory_order_relaxed))
+      max_.store(ns, std::memory_order_relaxed);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (int i = 0; i < num_buckets; ++i)
+      bump(counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+    bump(count_, other.count());
+    if (other.max() > max())
+      max_.store(other.max(), std::memory_order_relaxed);
+  }
+
+  void reset() {
+    for (auto &c : counts_)
+      c.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // upper bound of the bucket holding the q-quantile (0 <= q <= 1)
+  uint64_t percentile(double q) const {
+    uint64_t total = count();
+    if (total == 0)
+      return 0;
+    uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < num_buckets; ++i) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+        return std::min(bucket_upper(i), max());
+    }
+    return max();
+  }
+
+  static int bucket_of(uint64_t ns) {
+    if (ns < sub_buckets)
+      return static_cast<int>(ns);
+    int e = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>(ns >> (e - sub_bucket_bits)) & (sub_buckets - 1);
+    return (e - sub_bucket_bits + 1) * sub_buckets + sub;
+  }
+
+  static uint64_t bucket_upper(int i) {
+    if (i < sub_buckets)
+      return i;
+    int e = i / sub_buckets + sub_bucket_bits - 1;
+    uint64_t sub = i % sub_buckets;
+    uint64_t width = uint64_t(1) << (e - sub_bucket_bits);
+    return ((sub_buckets + sub) << (e - sub_bucket_bits)) + width - 1;
+  }
+
+private:
+  // single writer: a relaxed load and store, no locked instruction
+  static void bump(std::atomic<uint64_t> &c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> max_{0};
+  std::array<std::atomic<uint64_t>, num_buckets> counts_{};
+};
+
+/**
+ * Owns one set of histograms per thread. A thread's set is allocated on its
+ * first recorded operation, cache-line aligned so no two threads write the
+ * same line, and outlives the thread so its samples still show up in merged().
+ */
+class LatencyRecorder {
+public:
+#ifdef MASSTREE_WRAPPER_LATENCY
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+  using Histograms = std::array<LatencyHistogram, num_latency_ops>;
+
+  static void record(LatencyOp op, uint64_t ns) {
+    local().h[static_cast<std::size_t>(op)].record(ns);
+  }
+
+  static Histograms merged() {
+    Histograms out;
+    std::lock_guard<std::mutex> lk(registry().mutex);
+    for (const auto &set : registry().sets)
+      for (std::size_t op = 0; op < num_latency_ops; ++op)
+        out[op].merge(set->h[op]);
+    return out;
+  }
+
+  // meant for phase boundaries; counts recorded concurrently may be lost
+  static void reset() {
+    std::lock_guard<std::mutex> lk(registry().mutex);
+    for (const auto &set : registry().sets)
+      for (auto &h : set->h)
+        h.reset();
+  }
+
+  static void dump(FILE *out) {
+    static const char *const names[num_latency_ops] = {"get", "insert",
+                                                       "update", "remove",
+                                                       "scan"};
+    if (!enabled) {
+      fprintf(out, "latency histograms are disabled "
+                   "(build with -DMASSTREEWRAPPER_LATENCY=ON)\n");
+      return;
+    }
+    Histograms h = merged();
+    fprintf(out, "%-8s %12s %10s %10s %10s %10s\n", "op", "count", "p50(ns)",
+            "p99(ns)", "p99.9(ns)", "max(ns)");
+    for (std::size_t op = 0; op < num_latency_ops; ++op) {
+      if (h[op].count() == 0)
+        continue;
+      fprintf(out,
+              "%-8s %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+              " %10" PRIu64 "\n",
+              names[op], h[op].count(), h[op].percentile(0.5),
+              h[op].percentile(0.99), h[op].percentile(0.999), h[op].max());
+    }
+  }
+
+private:
+  struct alignas(64) ThreadSet {
+    Histograms h;
+  };
+
+  struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadSet>> sets;
+  };
+
+  static Registry &registry() {
+    static Registry r;
+    return r;
+  }
+
+  static ThreadSet &local() {
+    thread_local ThreadSet *set = [] {
+      std::lock_guard<std::mutex> lk(registry().mutex);
+      registry().sets.emplace_back(new ThreadSet);
+      return registry().sets.back().get();
+    }();
+    return *set;
+  }
+};
+
+// records the lifetime of the enclosing scope as one operation of type op
+class LatencyTimer {
+public:
+  explicit LatencyTimer(LatencyOp op) : op_(op), start_(now()) {}
+  ~LatencyTimer() { LatencyRecorder::record(op_, now() - start_); }
+
+private:
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  LatencyOp op_;
+  uint64_t start_;
+};
+
+#ifdef MASSTREE_WRAPPER_LATENCY
+#define MASSTREE_WRAPPER_TIME_OP(op)                                           \
+  LatencyTimer op_latency_timer(LatencyOp::op)
+#else
+#define MASSTREE_WRAPPER_TIME_OP(op)                                           \
+  do {                                                                         \
+  } while (0)
+#endif
@@ -13,18 +13,61 @@
 #include "masstree/masstree_tcursor.hh"
 #include "masstree/string.hh"
 
+#include "epoch_reclaimer.hpp"
+#include "latency_histogram.hpp"
+#include "node_set.hpp"
+#include "tree_stats.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 class key_unparse_unsigned {
 public:
   static int unparse_key(Masstree::key<uint64_t> key, char *buf, int buflen) {
     return snprintf(buf, buflen, "%" PRIu64, key.ikey());
   }
 };
-template <typename T> class MasstreeWrapper {
+/**
+ * LeafWidth and InternodeWidth set the fanout of the tree. A leaf keeps its
+ * slot order in a 64-bit permutation, which holds at most 15 slots. It needs
+ * at least 10: a leaf is never split between keys sharing an 8-byte slice,
+ * and ten keys can share one (lengths 0 to 8, plus one longer key or a
+ * layer). Internodes are searched by binary search, so they can go wider
+ * than leaves, up to the point where a node spans more cache lines than a
+ * lookup touches anyway.
+ */
+template <typename T, int LeafWidth = 15, int InternodeWidth = 15>
+class MasstreeWrapper {
+  static_assert(LeafWidth >= 10 && LeafWidth <= 15,
+                "leaf width must be within [10, 15]");
+  static_assert(InternodeWidth >= 4 && InternodeWidth <= 63,
+                "internode width must be within [4, 63]");
+
 public:
-  struct table_params : public Masstree::nodeparams<15, 15> {
+  static constexpr int leaf_width = LeafWidth;
+  static constexpr int internode_width = InternodeWidth;
+
+  struct table_params
+      : public Masstree::nodeparams<LeafWidth, InternodeWidth> {
     using value_type = T *;
     using value_print_type = Masstree::value_print<value_type>;
-    using threadinfo_type = threadinfo;
+    using threadinfo_type = reclaim_threadinfo;
     using key_unparse_type = key_unparse_unsigned;
   };
 
@@ -45,21 +88,158 @@ public:
     uint64_t old_version = 0;
     uint64_t new_version = 0;
   };
+  // leaves read by a transaction, for phantom detection (see node_set.hpp)
+  using NodeSet = BasicNodeSet<leaf_type>;
+
+  /**
+   * What a versioned read saw: the leaf that holds (or would hold) the key,
+   * its full version at the time, and for a found key the slot and the value
+   * it held. still_valid() rechecks these without a traversal.
+   */
+  struct VersionStamp {
+    const leaf_type *leaf = nullptr;
+    uint64_t version = 0;
+    int slot = -1; // -1: the key was absent
+    T *value = nullptr;
+
+    bool found() const { return slot >= 0; }
+  };
 
   MasstreeWrapper() { this->table_init(); }
 
   void table_init() {
     if (ti == nullptr)
-      ti = threadinfo::make(threadinfo::TI_MAIN, -1);
+      ti = reclaim_threadinfo::make(threadinfo::TI_MAIN, -1);
     table_.initialize(*ti);
   }
 
   static void thread_init(int thread_id) {
     if (ti == nullptr)
-      ti = threadinfo::make(threadinfo::TI_PROCESS, thread_id);
+      ti = reclaim_threadinfo::make(threadinfo::TI_PROCESS, thread_id);
+  }
+
+  /**
+   * thread_init() on the CPU that affinity gives thread_id (see
+   * numa_placement.hpp). The thread is pinned, and prefers its own node's
+   * memory, before its threadinfo exists, so the threadinfo, the node pools
+   * it refills and the values it allocates all end up on the local node.
+   * Returns the CPU, or -1 if the thread was left unpinned.
+   */
+  static int thread_init(int thread_id, CpuAffinity affinity) {
+    int cpu = NumaTopology::get().cpu_for_thread(thread_id, affinity);
+    if (cpu >= 0 && !bind_thread_to_cpu(cpu))
+      cpu = -1;
+    thread_init(thread_id);
+    return cpu;
+  }
+
+  /**
+   * Allocates internodes created from now on, by every tree in the process,
+   * from memory interleaved over all NUMA nodes (InternodeArena). Call it
+   * before loading. False, with nothing changed, on single-node machines.
+   */
+  static bool interleave_internodes() { return InternodeArena::get().enable(); }
+
+  /**
+   * Starts the background epoch advancer so memory freed by removes and
+   * splits is returned. Every thread quiesces on its own after
+   * quiesce_interval operations (0: only when quiesce() is called). A pointer
+   * returned by get_value() or a scan stays valid until the calling thread
+   * makes its next call into the wrapper.
+   */
+  void start_reclamation(
+      std::chrono::milliseconds epoch_interval = std::chrono::milliseconds(10),
+      uint64_t quiesce_interval = 1024) {
+    quiesce_interval_ = quiesce_interval;
+    reclaimer_.start(epoch_interval);
+  }
+
+  void stop_reclamation() {
+    reclaimer_.stop();
+    quiesce_interval_ = 0;
+  }
+
+  // the calling thread holds no pointer obtained from the tree before now
+  static void quiesce() {
+    ops_since_quiesce_ = 0;
+    if (online_) {
+      EpochReclaimer::quiesce(*ti);
+      ++rcu_generation_;
+    }
+  }
+
+  /**
+   * Stops the calling thread from holding back reclamation until its next
+   * operation. Idle threads should call this; it runs on thread exit too.
+   */
+  static void thread_offline() {
+    if (online_) {
+      ti->rcu_stop();
+      online_ = false;
+      ++rcu_generation_;
+    }
+  }
+
+  static EpochReclaimer::Stats reclaim_stats() {
+    return EpochReclaimer::stats();
+  }
+
+  /**
+   * Latency histograms of every thread's operations, merged (empty unless
+   * built with MASSTREE_WRAPPER_LATENCY). Scans are timed including their
+   * visitor callbacks.
+   */
+  static LatencyRecorder::Histograms latency_histograms() {
+    return LatencyRecorder::merged();
+  }
+
+  // count, p50, p99, p99.9 and max per operation type
+  static void dump_latency(FILE *out = stdout) { LatencyRecorder::dump(out); }
+
+  static void reset_latency() { LatencyRecorder::reset(); }
+
+  /**
+   * Shape and footprint of the tree (see TreeStats), from one pass over its
+   * nodes that reads them without locks and never touches values: about
+   * the cost of a scan that skips its rows, O(nodes). Under concurrent
+   * writes the counts are approximate.
+   *
+   * With reclamation running, the walk quiesces after every
+   * quiesce_interval leaves and descends again from where it stopped, so it
+   * never holds back the epoch for more than that; otherwise (and when
+   * called from a scan callback) the whole walk runs under one epoch pin.
+   */
+  TreeStats stats() {
+    begin_op();
+    auto start = std::chrono::steady_clock::now();
+    TreeStats s;
+    s.leaf_width = leaf_width;
+    s.internode_width = internode_width;
+    s.leaf_size = node_lines(sizeof(leaf_type));
+    s.internode_size = node_lines(sizeof(internode_type));
+    s.leaf_fill.assign(leaf_width + 1, 0);
+    s.internode_fill.assign(internode_width + 2, 0);
+    bool pieces = quiesce_interval_ != 0 && scan_depth_ == 0;
+    StatsWalk w{s};
+    for (;;) {
+      w.budget = pieces ? quiesce_interval_ : ~uint64_t(0);
+      w.stopped = 0;
+      stats_layer(table_.fix_root(), 0, std::string(), w);
+      if (!w.stopped)
+        break;
+      quiesce();
+    }
+    s.memory = PoolAccounting::usage();
+    s.rcu_pending_bytes = EpochReclaimer::stats().pending_bytes();
+    s.walk_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    return s;
   }
 
   bool insert_value(const char *key, std::size_t len_key, T *value) {
+    MASSTREE_WRAPPER_TIME_OP(insert);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found = lp.find_insert(*ti);
 
@@ -77,6 +257,8 @@ public:
   bool insert_value_and_get_nodeinfo_on_success(const char *key,
                                                 std::size_t len_key, T *value,
                                                 node_info_t &node_info) {
+    MASSTREE_WRAPPER_TIME_OP(insert);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found = lp.find_insert(*ti);
     if (found) {
@@ -93,7 +275,170 @@ public:
     return 1;
   }
 
+  // the insert is the caller's own: node_set follows the leaf's new version
+  bool insert_value_and_get_nodeinfo_on_success(const char *key,
+                                                std::size_t len_key, T *value,
+                                                NodeSet &node_set) {
+    node_info_t node_info;
+    if (!insert_value_and_get_nodeinfo_on_success(key, len_key, value,
+                                                  node_info))
+      return 0;
+    node_set.update(static_cast<const leaf_type *>(node_info.node),
+                    node_info.old_version, node_info.new_version);
+    return 1;
+  }
+
+  /**
+   * Inserts a range of (key, T *) pairs, keys as for bulk_load, into a tree
+   * that others may be using. The batch is sorted first unless it already
+   * is; then each leaf is found once and locked once for the run of keys
+   * that falls inside its bounds, which for time-ordered ingest is most of
+   * a leaf's worth. The next leaf is looked up from the root again only
+   * when a key leaves those bounds, and a key the leaf cannot take without
+   * a split or a new layer goes through insert_value. Keys that exist keep
+   * their value, as do later duplicates within the batch. Returns the
+   * number of keys inserted.
+   */
+  template <typename Iter>
+  std::size_t insert_batch(Iter first, Iter last) {
+    std::vector<BulkEntry> entries;
+    for (; first != last; ++first)
+      entries.push_back(
+          BulkEntry{reinterpret_cast<const char *>(first->first.data()),
+                    static_cast<int>(first->first.size()), first->second});
+    if (!std::is_sorted(entries.begin(), entries.end(), BulkEntry::less))
+      std::stable_sort(entries.begin(), entries.end(), BulkEntry::less);
+
+    std::size_t inserted = 0;
+    for (std::size_t i = 0; i < entries.size();) {
+      const BulkEntry &e = entries[i];
+      begin_op();
+      nodeversion_type v;
+      leaf_type *n =
+          table_.fix_root()->reach_leaf(key_type(e.key, e.len), v, *ti);
+      n->lock();
+      std::size_t run = i;
+      if (!n->deleted() && n->modstate_ == leaf_type::modstate_insert)
+        for (; run < entries.size(); ++run) {
+          int r = insert_locked(n, entries[run]);
+          if (r < 0)
+            break;
+          inserted += r;
+        }
+      n->unlock();
+      if (run == i) { // the first key needs a split or a layer
+        inserted += insert_value(e.key, e.len, e.value);
+        ++run;
+      }
+      i = run;
+    }
+    return inserted;
+  }
+
+  template <typename KVs> std::size_t insert_batch(const KVs &kvs) {
+    return insert_batch(std::begin(kvs), std::end(kvs));
+  }
+
+  /**
+   * Inserts value, or replaces the current value if the key exists, in one
+   * traversal under one lock of the key's leaf. Returns 1 if the key was
+   * inserted.
+   */
+  bool upsert(const char *key, std::size_t len_key, T *value) {
+    T *old_value;
+    return upsert_and_get_old(key, len_key, value, old_value);
+  }
+
+  // old_value is only obtained when an existing value was replaced
+  bool upsert_and_get_old(const char *key, std::size_t len_key, T *value,
+                          T *&old_value) {
+    MASSTREE_WRAPPER_TIME_OP(insert);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool found = lp.find_insert(*ti);
+    if (found)
+      old_value = lp.value();
+    lp.value() = value;
+    fence();
+    lp.finish(1, *ti); // finish insert, or just release the lock
+    return !found;
+  }
+
+  /**
+   * Inserts value unless the key exists. current is the value the key maps
+   * to afterwards: value if it was inserted (returns 1), the existing one
+   * otherwise (returns 0).
+   */
+  bool insert_or_get(const char *key, std::size_t len_key, T *value,
+                     T *&current) {
+    MASSTREE_WRAPPER_TIME_OP(insert);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool found = lp.find_insert(*ti);
+    if (!found) {
+      lp.value() = value;
+      fence();
+    }
+    current = lp.value();
+    lp.finish(1, *ti);
+    return !found;
+  }
+
+  // replaces the value with desired if the key maps to expected (pointers
+  // are compared, not what they point to)
+  bool compare_and_swap(const char *key, std::size_t len_key, T *expected,
+                        T *desired) {
+    MASSTREE_WRAPPER_TIME_OP(update);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool swapped = lp.find_locked(*ti) && lp.value() == expected;
+    if (swapped) {
+      lp.value() = desired;
+      fence();
+    }
+    lp.finish(0, *ti); // release lock
+    return swapped;
+  }
+
+  /**
+   * Calls bool fn(bool found, T *&value) with the key's leaf locked, value
+   * being the current value (nullptr if the key is absent). If fn returns
+   * true, value is stored, inserting the key if it was absent; otherwise the
+   * key ends as it was. fn is called once and must not call into the
+   * wrapper. Returns what fn returned.
+   *
+   * One traversal under one leaf lock, except when fn declines an absent
+   * key: find_insert has already taken a slot for it, which masstree cannot
+   * hand back, so the key is inserted mapped to nullptr and then removed
+   * again. Concurrent readers may briefly see it in that case.
+   */
+  template <typename F>
+  bool read_modify_write(const char *key, std::size_t len_key, F &&fn) {
+    MASSTREE_WRAPPER_TIME_OP(update);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool found = lp.find_insert(*ti);
+    T *value = found ? lp.value() : nullptr;
+    bool store = fn(found, value);
+    if (found && !store) {
+      lp.finish(0, *ti); // release lock
+      return 0;
+    }
+    lp.value() = store ? value : nullptr;
+    fence();
+    lp.finish(1, *ti); // finish insert, or just release the lock
+    if (!store) {
+      cursor_type rm(table_, key, len_key);
+      // unless another thread stored a value there meanwhile
+      bool placeholder = rm.find_locked(*ti) && rm.value() == nullptr;
+      rm.finish(placeholder ? -1 : 0, *ti);
+    }
+    return store;
+  }
+
   T *get_value(const char *key, std::size_t len_key) {
+    MASSTREE_WRAPPER_TIME_OP(get);
+    begin_op();
     unlocked_cursor_type lp(table_, key, len_key);
     bool found = lp.find_unlocked(*ti);
     if (found)
@@ -101,8 +446,21 @@ public:
     return nullptr;
   }
 
+  // tells a stored nullptr apart from a missing key
+  bool find_value(const char *key, std::size_t len_key, T *&value) {
+    MASSTREE_WRAPPER_TIME_OP(get);
+    begin_op();
+    unlocked_cursor_type lp(table_, key, len_key);
+    bool found = lp.find_unlocked(*ti);
+    if (found)
+      value = lp.value();
+    return found;
+  }
+
   T *get_value_and_get_nodeinfo_on_failure(const char *key, std::size_t len_key,
                                            node_info_t &node_info) {
+    MASSTREE_WRAPPER_TIME_OP(get);
+    begin_op();
     unlocked_cursor_type lp(table_, key, len_key);
     bool found = lp.find_unlocked(*ti);
     if (found)
@@ -115,7 +473,123 @@ public:
     return nullptr;
   }
 
+  // records the leaf that proves the key absent in node_set
+  T *get_value_and_get_nodeinfo_on_failure(const char *key, std::size_t len_key,
+                                           NodeSet &node_set) {
+    node_info_t node_info;
+    T *value = get_value_and_get_nodeinfo_on_failure(key, len_key, node_info);
+    if (node_info.node != nullptr)
+      node_set.add(static_cast<const leaf_type *>(node_info.node),
+                   node_info.old_version);
+    return value;
+  }
+
+  /**
+   * get_value() that also fills stamp, found or not, in the same unlocked
+   * traversal. still_valid(stamp) later tells whether the read would still
+   * return the same thing, which is what an OCC read set validates at commit.
+   */
+  T *get_value_versioned(const char *key, std::size_t len_key,
+                         VersionStamp &stamp) {
+    MASSTREE_WRAPPER_TIME_OP(get);
+    begin_op();
+    // find_unlocked, keeping the slot it settles on
+    key_type ka(key, len_key);
+    const node_type *layer = table_.fix_root();
+    for (;;) {
+      nodeversion_type v;
+      const leaf_type *n = layer->reach_leaf(ka, v, *ti);
+      while (!v.deleted()) {
+        LeafView view{n, n->permutation()};
+        Masstree::key_indexed_position kx =
+            leaf_type::bound_type::lower(ka, view);
+        typename leaf_type::leafvalue_type lv;
+        int match = 0;
+        if (kx.p >= 0) {
+          lv = n->lv_[kx.p];
+          match = n->ksuf_matches(kx.p, ka);
+        }
+        if (n->has_changed(v)) {
+          n = n->advance_to_key(ka, v, *ti);
+          continue;
+        }
+        if (match < 0) { // descend into the next layer
+          ka.shift_by(-match);
+          layer = lv.layer();
+          break;
+        }
+        stamp.leaf = n;
+        // as full_version_value() computes it, top bits shifted out
+        stamp.version = static_cast<nodeversion_value_type>(
+            (v.version_value() << permuter_type::size_bits) +
+            view.perm.size());
+        stamp.slot = match > 0 ? kx.p : -1;
+        stamp.value = match > 0 ? lv.value() : nullptr;
+        return stamp.value;
+      }
+    }
+  }
+
+  /**
+   * True if the leaf has not changed structurally since the stamp was taken
+   * (no insert, remove or split, and not locked right now) and the key's
+   * slot still holds the same value. Updates are seen as a different value
+   * pointer, so a writer must install a new T * rather than change *value
+   * in place. The leaf must not have been freed in between: with
+   * reclamation running, either validate within quiesce_interval operations
+   * of the read or start it with quiesce_interval 0 and call quiesce()
+   * between transactions.
+   */
+  static bool still_valid(const VersionStamp &stamp) {
+    if (stamp.leaf->full_version_value() != stamp.version)
+      return false;
+    acquire_fence();
+    return !stamp.found() || stamp.leaf->lv_[stamp.slot].value() == stamp.value;
+  }
+
+  static constexpr int multi_get_width = 8;
+
+  /**
+   * Looks up n keys at once. Up to multi_get_width lookups advance as
+   * interleaved state machines (AMAC): each step touches one node that was
+   * prefetched on the lookup's previous step and prefetches the next one, so
+   * the cache misses of different lookups overlap. A lookup that races with a
+   * concurrent split falls back to get_value's path. out[i] is nullptr for
+   * missing keys; returns the number of keys found.
+   */
+  std::size_t multi_get(const char *const *keys, const std::size_t *lens,
+                        T **out, std::size_t n) {
+    begin_op();
+    const node_type *root = table_.fix_root();
+    MultiGetLookup lookups[multi_get_width];
+    std::size_t next = 0;
+    std::size_t found = 0;
+    int active = 0;
+
+    for (; active < multi_get_width && next < n; ++active)
+      lookups[active].start(next++, keys, lens, root);
+
+    while (active > 0) {
+      for (int s = 0; s < multi_get_width; ++s) {
+        MultiGetLookup &lk = lookups[s];
+        if (lk.idle || !multi_get_step(lk, keys, lens))
+          continue;
+        out[lk.index] = lk.result;
+        found += lk.found;
+        if (next < n) {
+          lk.start(next++, keys, lens, root);
+        } else {
+          lk.idle = true;
+          --active;
+        }
+      }
+    }
+    return found;
+  }
+
   bool update_value(const char *key, std::size_t len_key, T *value) {
+    MASSTREE_WRAPPER_TIME_OP(update);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found =
         lp.find_locked(*ti); // lock a node which potentailly contains the value
@@ -131,9 +605,31 @@ public:
     return 0;          // not updated
   }
 
+  // old_value is only obtained on success of update
+  bool update_value_and_get_old(const char *key, std::size_t len_key,
+                                T *value, T *&old_value) {
+    MASSTREE_WRAPPER_TIME_OP(update);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool found =
+        lp.find_locked(*ti); // lock a node which potentailly contains the value
+
+    if (found) {
+      old_value = lp.value();
+      lp.value() = value;
+      fence();
+      lp.finish(0, *ti); // release lock
+      return 1;          // updated
+    }
+    lp.finish(0, *ti); // release lock
+    return 0;          // not updated
+  }
+
   bool update_value_and_get_nodeinfo_on_failure(const char *key,
                                                 std::size_t len_key, T *value,
                                                 node_info_t &node_info) {
+    MASSTREE_WRAPPER_TIME_OP(update);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found =
         lp.find_locked(*ti); // lock a node which potentailly contains the value
@@ -154,7 +650,21 @@ public:
     return 0;          // not updated
   }
 
+  bool update_value_and_get_nodeinfo_on_failure(const char *key,
+                                                std::size_t len_key, T *value,
+                                                NodeSet &node_set) {
+    node_info_t node_info;
+    if (update_value_and_get_nodeinfo_on_failure(key, len_key, value,
+                                                 node_info))
+      return 1;
+    node_set.add(static_cast<const leaf_type *>(node_info.node),
+                 node_info.old_version);
+    return 0;
+  }
+
   bool remove_value(const char *key, std::size_t len_key) {
+    MASSTREE_WRAPPER_TIME_OP(remove);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found =
         lp.find_locked(*ti); // lock a node which potentailly contains the value
@@ -169,9 +679,29 @@ public:
     return 0;          // not removed
   }
 
+  // old_value is only obtained on success of remove
+  bool remove_value_and_get_old(const char *key, std::size_t len_key,
+                                T *&old_value) {
+    MASSTREE_WRAPPER_TIME_OP(remove);
+    begin_op();
+    cursor_type lp(table_, key, len_key);
+    bool found =
+        lp.find_locked(*ti); // lock a node which potentailly contains the value
+
+    if (found) {
+      old_value = lp.value();
+      lp.finish(-1, *ti); // finish remove
+      return 1;           // removed
+    }
+    lp.finish(0, *ti); // release lock
+    return 0;          // not removed
+  }
+
   bool remove_value_and_get_nodeinfo_on_failure(const char *key,
                                                 std::size_t len_key,
                                                 node_info_t &node_info) {
+    MASSTREE_WRAPPER_TIME_OP(remove);
+    begin_op();
     cursor_type lp(table_, key, len_key);
     bool found =
         lp.find_locked(*ti); // lock a node which potentailly contains the value
@@ -189,24 +719,150 @@ public:
     return 0;          // not removed
   }
 
+  bool remove_value_and_get_nodeinfo_on_failure(const char *key,
+                                                std::size_t len_key,
+                                                NodeSet &node_set) {
+    node_info_t node_info;
+    if (remove_value_and_get_nodeinfo_on_failure(key, len_key, node_info))
+      return 1;
+    node_set.add(static_cast<const leaf_type *>(node_info.node),
+                 node_info.old_version);
+    return 0;
+  }
+
+  /**
+   * Builds the tree bottom-up from a range of (key, T *) pairs, where a key
+   * is anything with data() and size() (std::string, std::string_view,
+   * std::vector<uint8_t>...). The tree must be empty and nobody else may use
+   * it until bulk_load returns. Leaves and internodes are filled to
+   * fill_factor of their width; keys sharing an 8-byte slice get a layer of
+   * their own, built the same way. The key range is split between
+   * num_threads of the scan workers (see start_scan_workers). Unsorted input
+   * is sorted first and duplicate keys keep their first value. Returns the
+   * number of keys loaded, 0 if the tree was not empty.
+   */
+  template <typename Iter>
+  std::size_t bulk_load(Iter first, Iter last, double fill_factor = 1.0,
+                        std::size_t num_threads = 1) {
+    begin_op();
+    node_type *root = table_.fix_root();
+    if (!root->isleaf() || static_cast<leaf_type *>(root)->size() != 0)
+      return 0;
+
+    std::vector<BulkEntry> entries;
+    for (; first != last; ++first)
+      entries.push_back(
+          BulkEntry{reinterpret_cast<const char *>(first->first.data()),
+                    static_cast<int>(first->first.size()), first->second});
+    if (!std::is_sorted(entries.begin(), entries.end(), BulkEntry::less))
+      std::stable_sort(entries.begin(), entries.end(), BulkEntry::less);
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](const BulkEntry &a, const BulkEntry &b) {
+                                return !BulkEntry::less(a, b);
+                              }),
+                  entries.end());
+    if (entries.empty())
+      return 0;
+
+    // cut the first layer into ranges that never split a slice
+    const BulkEntry *data = entries.data();
+    std::size_t n = entries.size();
+    // a thread per range of at least this many keys
+    num_threads = std::max<std::size_t>(1, std::min(num_threads, n / 4096));
+    std::vector<std::size_t> cuts{0};
+    for (std::size_t t = 1; t < num_threads; ++t) {
+      std::size_t c = n * t / num_threads;
+      if (c <= cuts.back())
+        continue;
+      while (c < n && data[c].slice(0) == data[c - 1].slice(0))
+        ++c;
+      if (c < n)
+        cuts.push_back(c);
+    }
+    cuts.push_back(n);
+
+    // the table's root leaf becomes the leftmost leaf
+    std::size_t chunks = cuts.size() - 1;
+    std::vector<std::vector<node_type *>> leaves(chunks);
+    auto build = [&](std::size_t c) {
+      BulkLoader loader(fill_factor, *ti);
+      loader.build_leaves(data + cuts[c], data + cuts[c + 1], 0,
+                          c == 0 ? static_cast<leaf_type *>(root) : nullptr,
+                          leaves[c]);
+    };
+    if (chunks == 1)
+      build(0);
+    else
+      run_on_workers(chunks, build);
+
+    std::vector<node_type *> level;
+    for (auto &chunk : leaves)
+      level.insert(level.end(), chunk.begin(), chunk.end());
+    if (BulkLoader(fill_factor, *ti).build_upper(level) != root)
+      root->mark_nonroot();
+    // lookups climb from the stale root; fix_root() moves it up as they go
+    table_.fix_root();
+    return n;
+  }
+
+  /**
+   * Scan visitors are passed by type so the per-kv body can be inlined:
+   *   void per_kv(const Str &key, const T *val, bool &continue_flag);
+   *   void per_node(const leaf_type *leaf, uint64_t version,
+   *                 bool &continue_flag); // optional
+   * Callback is the type-erased visitor.
+   */
   class Callback {
   public:
     std::function<void(const leaf_type *, uint64_t, bool &)> per_node_func;
     std::function<void(const Str &, const T *, bool &)> per_kv_func;
+
+    void per_node(const leaf_type *leaf, uint64_t version,
+                  bool &continue_flag) {
+      per_node_func(leaf, version, continue_flag);
+    }
+    void per_kv(const Str &key, const T *val, bool &continue_flag) {
+      per_kv_func(key, val, continue_flag);
+    }
   };
-  class SearchRangeScanner {
+
+  template <typename Visitor, typename = void>
+  struct has_per_node : std::false_type {};
+  template <typename Visitor>
+  struct has_per_node<
+      Visitor, std::void_t<decltype(std::declval<Visitor &>().per_node(
+                   std::declval<const leaf_type *>(), uint64_t{},
+                   std::declval<bool &>()))>> : std::true_type {};
+
+  /**
+   * How scan() and rscan() test rows against the far end of their range.
+   * per_row compares each key with it. per_leaf first compares the end key
+   * with the leaf's highest ikey (lowest, for rscan()): a leaf wholly inside
+   * the range emits its rows without comparing them, and only the leaf the
+   * range ends in compares row by row.
+   */
+  enum class ScanBoundCheck { per_row, per_leaf };
+
+  // per_leaf unless set otherwise; not for use while scans run
+  void set_scan_bound_check(ScanBoundCheck check) { scan_bound_check_ = check; }
+
+  template <typename Visitor = Callback> class SearchRangeScanner {
   public:
     SearchRangeScanner(const char *const rkey, const std::size_t len_rkey,
-                       const bool r_exclusive, Callback &callback,
-                       int64_t max_scan_num = -1)
+                       const bool r_exclusive, Visitor &visitor,
+                       int64_t max_scan_num = -1,
+                       ScanBoundCheck bound_check = ScanBoundCheck::per_leaf)
         : rkey_(rkey), len_rkey_(len_rkey), r_exclusive_(r_exclusive),
-          callback_(callback), max_scan_num_(max_scan_num) {}
+          visitor_(visitor), max_scan_num_(max_scan_num),
+          per_leaf_(bound_check == ScanBoundCheck::per_leaf) {}
 
     template <typename ScanStackElt, typename Key>
     void visit_leaf(const ScanStackElt &iter, const Key &key, threadinfo &) {
-      (void)key;
-      callback_.per_node_func(iter.node(), iter.full_version_value(),
-                              continue_flag);
+      inside_ = per_leaf_ && rkey_ != nullptr &&
+                leaf_inside_bound(iter, key, rkey_, len_rkey_, true);
+      if constexpr (has_per_node<Visitor>::value)
+        visitor_.per_node(iter.node(), iter.full_version_value(),
+                          continue_flag);
     }
 
     bool visit_value(const Str key, T *val, threadinfo &) {
@@ -218,8 +874,9 @@ public:
 
       bool endless_key = (rkey_ == nullptr);
 
-      if (endless_key) {
-        callback_.per_kv_func(key, val, continue_flag);
+      // inside_: the whole leaf sorts before the end key
+      if (endless_key || inside_) {
+        visitor_.per_kv(key, val, continue_flag);
         return true;
       }
 
@@ -236,7 +893,7 @@ public:
 
       if (smaller_than_end_key || same_as_end_key_but_shorter ||
           same_as_end_key_inclusive) {
-        callback_.per_kv_func(key, val, continue_flag);
+        visitor_.per_kv(key, val, continue_flag);
         return true;
       }
 
@@ -248,10 +905,12 @@ public:
     const std::size_t len_rkey_{};
     const bool r_exclusive_{};
     std::vector<const T *> scan_buffer_{};
-    Callback &callback_;
+    Visitor &visitor_;
     const bool limited_scan_{false};
     int64_t scan_num_cnt_ = 0;
     int64_t max_scan_num_ = -1;
+    const bool per_leaf_;
+    bool inside_ = false;
 
     bool continue_flag = true;
   };
@@ -260,27 +919,42 @@ public:
             const bool l_exclusive, const char *const rkey,
             const std::size_t len_rkey, const bool r_exclusive,
             Callback &&callback, int64_t max_scan_num = -1) {
+    scan<Callback &>(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive,
+                     callback, max_scan_num);
+  }
 
+  template <typename Visitor>
+  void scan(const char *const lkey, const std::size_t len_lkey,
+            const bool l_exclusive, const char *const rkey,
+            const std::size_t len_rkey, const bool r_exclusive,
+            Visitor &&visitor, int64_t max_scan_num = -1) {
+    MASSTREE_WRAPPER_TIME_OP(scan);
+    begin_op();
     Str mtkey = (lkey == nullptr ? Str() : Str(lkey, len_lkey));
 
-    SearchRangeScanner scanner(rkey, len_rkey, r_exclusive, callback,
-                               max_scan_num);
+    SearchRangeScanner<std::remove_reference_t<Visitor>> scanner(
+        rkey, len_rkey, r_exclusive, visitor, max_scan_num, scan_bound_check_);
+    ScanDepth depth;
     table_.scan(mtkey, !l_exclusive, scanner, *ti);
   }
 
-  class BackwordScanner {
+  template <typename Visitor = Callback> class BackwordScanner {
   public:
     BackwordScanner(const char *const lkey, const std::size_t len_lkey,
-                    const bool l_exclusive, Callback &callback,
-                    int64_t max_scan_num = -1)
+                    const bool l_exclusive, Visitor &visitor,
+                    int64_t max_scan_num = -1,
+                    ScanBoundCheck bound_check = ScanBoundCheck::per_leaf)
         : lkey_(lkey), len_lkey_(len_lkey), l_exclusive_(l_exclusive),
-          callback_(callback), max_scan_num_(max_scan_num) {}
+          visitor_(visitor), max_scan_num_(max_scan_num),
+          per_leaf_(bound_check == ScanBoundCheck::per_leaf) {}
 
     template <typename ScanStackElt, typename Key>
     void visit_leaf(const ScanStackElt &iter, const Key &key, threadinfo &) {
-      (void)key;
-      callback_.per_node_func(iter.node(), iter.full_version_value(),
-                              continue_flag);
+      inside_ = per_leaf_ && lkey_ != nullptr &&
+                leaf_inside_bound(iter, key, lkey_, len_lkey_, false);
+      if constexpr (has_per_node<Visitor>::value)
+        visitor_.per_node(iter.node(), iter.full_version_value(),
+                          continue_flag);
     }
 
     bool visit_value(const Str key, T *val, threadinfo &) {
@@ -292,8 +966,9 @@ public:
 
       bool endless_key = (lkey_ == nullptr);
 
-      if (endless_key) {
-        callback_.per_kv_func(key, val, continue_flag);
+      // inside_: the whole leaf sorts after the end key
+      if (endless_key || inside_) {
+        visitor_.per_kv(key, val, continue_flag);
         return true;
       }
 
@@ -310,7 +985,7 @@ public:
 
       if (bigger_than_end_key || same_as_end_key_but_longer ||
           same_as_end_key_inclusive) {
-        callback_.per_kv_func(key, val, continue_flag);
+        visitor_.per_kv(key, val, continue_flag);
         return true;
       }
 
@@ -322,9 +997,11 @@ public:
     const std::size_t len_lkey_{};
     const bool l_exclusive_{};
     std::vector<const T *> scan_buffer_{};
-    Callback &callback_;
+    Visitor &visitor_;
     int64_t scan_num_cnt_ = 0;
     int64_t max_scan_num_ = -1;
+    const bool per_leaf_;
+    bool inside_ = false;
 
     bool continue_flag = true;
   };
@@ -333,24 +1010,1591 @@ public:
              const bool l_exclusive, const char *const rkey,
              const std::size_t len_rkey, const bool r_exclusive,
              Callback &&callback, int64_t max_scan_num = -1) {
+    rscan<Callback &>(lkey, len_lkey, l_exclusive, rkey, len_rkey,
+                      r_exclusive, callback, max_scan_num);
+  }
+
+  template <typename Visitor>
+  void rscan(const char *const lkey, const std::size_t len_lkey,
+             const bool l_exclusive, const char *const rkey,
+             const std::size_t len_rkey, const bool r_exclusive,
+             Visitor &&visitor, int64_t max_scan_num = -1) {
+    MASSTREE_WRAPPER_TIME_OP(scan);
+    begin_op();
     Str mtkey = (lkey == nullptr ? Str() : Str(rkey, len_rkey));
 
-    BackwordScanner scanner(lkey, len_lkey, l_exclusive, callback,
-                            max_scan_num);
+    BackwordScanner<std::remove_reference_t<Visitor>> scanner(
+        lkey, len_lkey, l_exclusive, visitor, max_scan_num, scan_bound_check_);
+    ScanDepth depth;
     table_.rscan(mtkey, !r_exclusive, scanner, *ti);
   }
 
+  /**
+   * scan()/rscan() that record every leaf they visit in node_set (the
+   * visitor's own per_node, if any, still runs). A leaf seen again at a
+   * different version ends the scan and leaves node_set conflicted.
+   */
+  template <typename Visitor>
+  void scan(const char *const lkey, const std::size_t len_lkey,
+            const bool l_exclusive, const char *const rkey,
+            const std::size_t len_rkey, const bool r_exclusive,
+            Visitor &&visitor, NodeSet &node_set, int64_t max_scan_num = -1) {
+    NodeRecorder<std::remove_reference_t<Visitor>> recorder{visitor,
+                                                            node_set};
+    scan(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive, recorder,
+         max_scan_num);
+  }
+
+  void scan(const char *const lkey, const std::size_t len_lkey,
+            const bool l_exclusive, const char *const rkey,
+            const std::size_t len_rkey, const bool r_exclusive,
+            Callback &&callback, NodeSet &node_set,
+            int64_t max_scan_num = -1) {
+    scan<Callback &>(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive,
+                     callback, node_set, max_scan_num);
+  }
+
+  template <typename Visitor>
+  void rscan(const char *const lkey, const std::size_t len_lkey,
+             const bool l_exclusive, const char *const rkey,
+             const std::size_t len_rkey, const bool r_exclusive,
+             Visitor &&visitor, NodeSet &node_set, int64_t max_scan_num = -1) {
+    NodeRecorder<std::remove_reference_t<Visitor>> recorder{visitor,
+                                                            node_set};
+    rscan(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive, recorder,
+          max_scan_num);
+  }
+
+  void rscan(const char *const lkey, const std::size_t len_lkey,
+             const bool l_exclusive, const char *const rkey,
+             const std::size_t len_rkey, const bool r_exclusive,
+             Callback &&callback, NodeSet &node_set,
+             int64_t max_scan_num = -1) {
+    rscan<Callback &>(lkey, len_lkey, l_exclusive, rkey, len_rkey,
+                      r_exclusive, callback, node_set, max_scan_num);
+  }
+
+  /**
+   * Pull-style iteration in key order, for paginated reads. A cursor keeps a
+   * copy of the leaf it stands in (keys, values and the leaf's version), one
+   * per layer for long keys sharing a prefix, so next() and prev() inside a
+   * leaf do not touch the tree and next() moves to the following leaf along
+   * its link when the leaf is unchanged. It descends from the root again
+   * only for a fresh seek, when a leaf it stands in was removed, when prev()
+   * crosses a leaf boundary, and when the calling thread quiesced (or a
+   * different thread picks the cursor up) since the last call: the leaves it
+   * remembers may be freed by then, and the cursor resumes from its key.
+   *
+   * Keys of one leaf come from one consistent read of it; keys inserted into
+   * a leaf after the cursor read it may be missed.
+   */
+  class Cursor {
+  public:
+    // range-for over the keys from the cursor's position on
+    class iterator {
+    public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = std::pair<std::string_view, T *>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = value_type;
+
+      iterator() = default;
+      explicit iterator(Cursor *c) : c_(c) {}
+
+      value_type operator*() const { return {c_->key(), c_->value()}; }
+      iterator &operator++() {
+        if (!c_->next())
+          c_ = nullptr;
+        return *this;
+      }
+      bool operator==(const iterator &o) const { return c_ == o.c_; }
+      bool operator!=(const iterator &o) const { return c_ != o.c_; }
+
+    private:
+      Cursor *c_ = nullptr;
+    };
+
+    explicit Cursor(MasstreeWrapper &mt) : mt_(&mt) {}
+
+    // first key not less than key (greater, if exclusive); false if none
+    bool seek(const char *key, std::size_t len, bool exclusive = false) {
+      mt_->begin_op();
+      target_.assign(key, len);
+      return reseek(exclusive);
+    }
+
+    bool seek_to_first() { return seek("", 0); }
+
+    // last key not greater than key (less, if exclusive); false if none
+    bool seek_for_prev(const char *key, std::size_t len,
+                       bool exclusive = false) {
+      return seek_before(key, len, !exclusive);
+    }
+
+    bool next() {
+      if (!valid_)
+        return 0;
+      mt_->begin_op();
+      if (stale()) {
+        target_ = key_;
+        return reseek(true);
+      }
+      for (std::size_t d = depth_; d-- > 0;) {
+        restart_ = false;
+        if (advance(d))
+          return 1;
+        if (restart_) {
+          target_ = key_;
+          return reseek(true);
+        }
+      }
+      return valid_ = 0;
+    }
+
+    bool prev() {
+      if (!valid_)
+        return 0;
+      Frame &f = frames_[depth_ - 1];
+      if (f.pos > 0 && !f.entries[f.pos - 1].layer) {
+        --f.pos;
+        emit(depth_ - 1);
+        return 1;
+      }
+      std::string key = key_;
+      return seek_before(key.data(), key.size(), false);
+    }
+
+    bool valid() const { return valid_; }
+    std::string_view key() const { return key_; }
+    T *value() const {
+      const Frame &f = frames_[depth_ - 1];
+      return f.entries[f.pos].lv.value();
+    }
+
+    iterator begin() { return iterator(valid_ ? this : nullptr); }
+    iterator end() { return iterator(); }
+
+  private:
+    struct Entry {
+      uint32_t offset; // in Frame::bytes, of the key from this layer on
+      uint32_t len;
+      bool layer; // lv leads to the next layer; the bytes are its 8-byte slice
+      typename leaf_type::leafvalue_type lv;
+    };
+
+    struct Frame {
+      const leaf_type *leaf = nullptr;
+      uint64_t version = 0;
+      std::vector<Entry> entries;
+      std::string bytes;
+      int pos = 0;
+
+      const char *key(int i) const { return bytes.data() + entries[i].offset; }
+    };
+
+    // memcmp order, a proper prefix first
+    static int compare(const char *a, std::size_t alen, const char *b,
+                       std::size_t blen) {
+      int c = memcmp(a, b, std::min(alen, blen));
+      return c != 0 ? c : (alen > blen) - (alen < blen);
+    }
+
+    bool stale() const {
+      return thread_ != ti || generation_ != rcu_generation_;
+    }
+
+    // copies leaf n in key order into frame d; false if n was removed
+    bool load(std::size_t d, const leaf_type *n) {
+      if (frames_.size() <= d)
+        frames_.resize(d + 1);
+      Frame &f = frames_[d];
+      for (;;) {
+        typename leaf_type::nodeversion_type v = n->stable();
+        if (v.deleted())
+          return 0;
+        typename leaf_type::permuter_type perm = n->permutation();
+        f.entries.clear();
+        f.bytes.clear();
+        for (int i = 0; i < perm.size(); ++i) {
+          int p = perm[i];
+          int keylenx = n->keylenx_[p];
+          uint64_t slice = __builtin_bswap64(n->ikey0_[p]);
+          Entry e{static_cast<uint32_t>(f.bytes.size()), 0,
+                  leaf_type::keylenx_is_layer(keylenx), n->lv_[p]};
+          f.bytes.append(reinterpret_cast<const char *>(&slice),
+                         std::min(keylenx, 8));
+          if (leaf_type::keylenx_has_ksuf(keylenx)) {
+            Str suffix = n->ksuf(p);
+            f.bytes.append(suffix.s, suffix.len);
+          }
+          e.len = static_cast<uint32_t>(f.bytes.size()) - e.offset;
+          f.entries.push_back(e);
+        }
+        if (!n->has_changed(v)) {
+          f.leaf = n;
+          f.version = static_cast<nodeversion_value_type>(
+              (v.version_value() << leaf_type::permuter_type::size_bits) +
+              perm.size());
+          return 1;
+        }
+      }
+    }
+
+    // the cursor stands on frame d's current entry, a plain key
+    bool emit(std::size_t d) {
+      key_.clear();
+      for (std::size_t i = 0; i < d; ++i)
+        key_.append(frames_[i].key(frames_[i].pos), 8);
+      const Frame &f = frames_[d];
+      key_.append(f.key(f.pos), f.entries[f.pos].len);
+      depth_ = d + 1;
+      return valid_ = 1;
+    }
+
+    // from the top, to the first key past (or at) target_
+    bool reseek(bool exclusive) {
+      thread_ = ti;
+      generation_ = rcu_generation_;
+      for (;;) {
+        restart_ = false;
+        if (seek_layer(0, mt_->table_.fix_root(), target_.data(),
+                       target_.size(), exclusive))
+          return 1;
+        if (!restart_)
+          return valid_ = 0;
+      }
+    }
+
+    // frame d to the first key past (or at) t in the layer under root
+    bool seek_layer(std::size_t d, const node_type *root, const char *t,
+                    std::size_t tlen, bool exclusive) {
+      key_type ka(t, tlen);
+      typename leaf_type::nodeversion_type v;
+      return walk(d, root->reach_leaf(ka, v, *ti), t, tlen, exclusive);
+    }
+
+    // seek_layer() from leaf n on, following the leaf links
+    bool walk(std::size_t d, const leaf_type *n, const char *t,
+              std::size_t tlen, bool exclusive) {
+      for (;;) {
+        if (!load(d, n)) {
+          restart_ = true;
+          return 0;
+        }
+        Frame &f = frames_[d];
+        for (f.pos = 0; f.pos < static_cast<int>(f.entries.size()); ++f.pos) {
+          if (settle(d, t, tlen, exclusive))
+            return 1;
+          if (restart_)
+            return 0;
+        }
+        // the keys may have moved right in a split since n was reached
+        const leaf_type *next = n->safe_next();
+        acquire_fence();
+        if (n->full_version_value() != f.version)
+          continue;
+        if (next == nullptr)
+          return 0;
+        n = next;
+      }
+    }
+
+    /**
+     * Whether frame d's current entry holds a key past (or at) t, entering
+     * the next layer down if the entry is one.
+     */
+    bool settle(std::size_t d, const char *t, std::size_t tlen,
+                bool exclusive) {
+      const Frame &f = frames_[d];
+      const Entry &e = f.entries[f.pos];
+      int c = compare(f.key(f.pos), e.len, t, tlen);
+      if (!e.layer)
+        return (c > 0 || (c == 0 && !exclusive)) && emit(d);
+      // every key in the layer is longer than its slice
+      if (c >= 0)
+        return seek_layer(d + 1, e.lv.layer(), "", 0, false);
+      if (tlen > 8 && memcmp(f.key(f.pos), t, 8) == 0)
+        return seek_layer(d + 1, e.lv.layer(), t + 8, tlen - 8, exclusive);
+      return 0;
+    }
+
+    // moves frame d past its current entry, along the leaf links
+    bool advance(std::size_t d) {
+      for (;;) {
+        Frame &f = frames_[d];
+        while (++f.pos < static_cast<int>(f.entries.size())) {
+          const Entry &e = f.entries[f.pos];
+          if (!e.layer)
+            return emit(d);
+          if (seek_layer(d + 1, e.lv.layer(), "", 0, false))
+            return 1;
+          if (restart_)
+            return 0;
+        }
+        const leaf_type *n = f.leaf;
+        const leaf_type *next = n->safe_next();
+        acquire_fence();
+        if (n->full_version_value() != f.version) {
+          // changed since it was read: find our place in it again
+          target_ = key_;
+          return walk(d, n, target_.data() + 8 * d, target_.size() - 8 * d,
+                      true);
+        }
+        if (next == nullptr)
+          return 0;
+        if (!load(d, next)) {
+          restart_ = true;
+          return 0;
+        }
+        frames_[d].pos = -1;
+      }
+    }
+
+    // to the last key below key (or at it, if inclusive)
+    bool seek_before(const char *key, std::size_t len, bool inclusive) {
+      struct Last {
+        std::string key;
+        bool found = false;
+        void per_kv(const Str &k, const T *, bool &) {
+          key.assign(k.s, k.len);
+          found = true;
+        }
+      };
+      for (;;) {
+        Last last;
+        mt_->rscan("", 0, false, key, len, !inclusive, last, 1);
+        if (!last.found)
+          return valid_ = 0;
+        // it may be gone again by now, and the seek end up past key
+        if (seek(last.key.data(), last.key.size())) {
+          int c = compare(key_.data(), key_.size(), key, len);
+          if (c < 0 || (c == 0 && inclusive))
+            return 1;
+        }
+      }
+    }
+
+    MasstreeWrapper *mt_;
+    std::deque<Frame> frames_; // one per layer; references survive growth
+    std::size_t depth_ = 0;
+    std::string key_;
+    std::string target_;
+    bool valid_ = 0;
+    bool restart_ = 0; // a leaf on the way was removed: start from the top
+    const typename table_params::threadinfo_type *thread_ = nullptr;
+    uint64_t generation_ = 0;
+  };
+
+  Cursor cursor() { return Cursor(*this); }
+
+  /**
+   * Number of keys in the range scan() would visit, counted per leaf from
+   * its permutation and key slices; values are never read. Only keys that
+   * share their 8-byte slice with an end key are compared whole. Each leaf
+   * is counted from one consistent read, like a scan's.
+   */
+  std::size_t count_range(const char *const lkey, const std::size_t len_lkey,
+                          const bool l_exclusive, const char *const rkey,
+                          const std::size_t len_rkey, const bool r_exclusive) {
+    begin_op();
+    CountRange r(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive);
+    for (;;) {
+      std::size_t count = 0;
+      // a leaf on the way was removed: count again from the top
+      if (count_layer(table_.fix_root(), r, count))
+        return count;
+    }
+  }
+
+  /**
+   * Approximate count_range(), for query planning: descends only the paths
+   * to the two end keys, counts their leaves exactly and sizes every subtree
+   * between the paths from the average fanout seen at its level. A layer
+   * inside such a subtree counts as one key. Costs about two lookups.
+   */
+  std::size_t estimate_range(const char *const lkey,
+                             const std::size_t len_lkey,
+                             const bool l_exclusive, const char *const rkey,
+                             const std::size_t len_rkey,
+                             const bool r_exclusive) {
+    begin_op();
+    CountRange r(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive);
+    int budget = 64;
+    return static_cast<std::size_t>(
+        std::llround(estimate_layer(table_.fix_root(), r, budget)));
+  }
+
+  /**
+   * Removes every key in the range scan() would visit and returns how many
+   * went. Each leaf is locked once and loses all its keys in the range with
+   * one permutation store; layers in the range are emptied the same way.
+   * A leaf that would be left empty keeps its last key for one ordinary
+   * remove, which unlinks the leaf, collapses internodes and layers left
+   * without children and frees them all through RCU. Values are not freed.
+   * Not atomic: keys inserted into the range meanwhile may survive.
+   */
+  std::size_t remove_range(const char *const lkey, const std::size_t len_lkey,
+                           const bool l_exclusive, const char *const rkey,
+                           const std::size_t len_rkey,
+                           const bool r_exclusive) {
+    begin_op();
+    // leaves found on the way must outlive the removes made through tcursor
+    ScanDepth depth;
+    CountRange r(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive);
+    std::size_t removed = 0;
+    // a leaf on the way was removed: go again from the top
+    while (!remove_layer(table_.fix_root(), r, std::string(), removed))
+      ;
+    return removed;
+  }
+
+  // threads used by parallel scans and bulk_load (default: one per hardware
+  // thread)
+  void start_scan_workers(std::size_t num_workers) {
+    std::lock_guard<std::mutex> lk(scan_pool_mutex_);
+    scan_pool_.reset(new WorkerPool(std::max<std::size_t>(num_workers, 1),
+                                    [](std::size_t) { thread_init(-1); }));
+  }
+
+  /**
+   * Scans the same range as scan(), split at separator keys taken from the
+   * first layer's upper internodes (descending further while the range spans
+   * too few of them) and scanned by the scan workers. Delivery is unordered:
+   * worker w feeds visitors[w], rows of one subrange arrive in key order, and
+   * subranges are handed out to whichever worker is free. A visitor clearing
+   * continue_flag ends only its current subrange. visitors must not be
+   * empty. One parallel scan runs at a time; concurrent calls wait for each
+   * other.
+   */
+  template <typename Visitor>
+  void parallel_scan(const char *const lkey, const std::size_t len_lkey,
+                     const bool l_exclusive, const char *const rkey,
+                     const std::size_t len_rkey, const bool r_exclusive,
+                     std::vector<Visitor> &visitors) {
+    always_assert(!visitors.empty(), "parallel_scan without visitors");
+    begin_op();
+    std::lock_guard<std::mutex> lk(scan_pool_mutex_);
+    WorkerPool &pool = scan_pool();
+    std::size_t workers = std::min(pool.size(), visitors.size());
+    ScanRanges ranges(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive);
+    ranges.split(*this, 4 * workers);
+
+    std::atomic<std::size_t> next{0};
+    pool.run_all([&](std::size_t w) {
+      if (w >= workers)
+        return;
+      for (std::size_t i; (i = next.fetch_add(1)) < ranges.size();)
+        ranges.scan(*this, i, visitors[w], -1);
+      thread_offline();
+    });
+  }
+
+  /**
+   * Like parallel_scan, but rows reach visitor.per_kv on the calling thread
+   * in key order, up to max_scan_num of them, as with scan(). Workers copy
+   * the keys of a bounded window of subranges ahead of the one being
+   * delivered. Values stay valid until the caller's next call into the
+   * wrapper. per_node is not called.
+   */
+  template <typename Visitor>
+  void parallel_scan_ordered(const char *const lkey,
+                             const std::size_t len_lkey,
+                             const bool l_exclusive, const char *const rkey,
+                             const std::size_t len_rkey,
+                             const bool r_exclusive, Visitor &&visitor,
+                             int64_t max_scan_num = -1) {
+    begin_op();
+    std::lock_guard<std::mutex> lk(scan_pool_mutex_);
+    WorkerPool &pool = scan_pool();
+    ScanRanges ranges(lkey, len_lkey, l_exclusive, rkey, len_rkey, r_exclusive);
+    ranges.split(*this, 8 * pool.size());
+
+    std::size_t n = ranges.size();
+    std::vector<std::vector<std::pair<std::string, const T *>>> rows(n);
+    std::vector<char> done(n, 0);
+    std::size_t next = 0;
+    std::size_t delivered = 0;
+    const std::size_t window = 2 * pool.size();
+    std::atomic<bool> cancel{false};
+    std::mutex m;
+    std::condition_variable cv;
+
+    pool.start([&](std::size_t) {
+      {
+        // the caller has not seen these rows yet; never quiesce under them
+        ScanDepth depth;
+        for (;;) {
+          std::size_t i;
+          {
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&] {
+              return cancel || next >= n || next < delivered + window;
+            });
+            if (cancel || next >= n)
+              break;
+            i = next++;
+          }
+          RowCollector collector{rows[i], cancel};
+          ranges.scan(*this, i, collector, max_scan_num);
+          {
+            std::lock_guard<std::mutex> lk(m);
+            done[i] = 1;
+          }
+          cv.notify_all();
+        }
+      }
+      thread_offline();
+    });
+    // the workers use the locals above, so they are stopped and waited for
+    // however this returns, a throwing per_kv included
+    struct StopWorkers {
+      WorkerPool &pool;
+      std::mutex &m;
+      std::condition_variable &cv;
+      std::atomic<bool> &cancel;
+      ~StopWorkers() {
+        {
+          std::lock_guard<std::mutex> lk(m);
+          cancel = true;
+        }
+        cv.notify_all();
+        pool.wait();
+      }
+    } stop{pool, m, cv, cancel};
+
+    bool continue_flag = true;
+    int64_t emitted = 0;
+    for (std::size_t i = 0; i < n && continue_flag; ++i) {
+      {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&] { return done[i] != 0; });
+      }
+      for (const auto &row : rows[i]) {
+        if (max_scan_num >= 0 && emitted >= max_scan_num) {
+          continue_flag = false;
+          break;
+        }
+        ++emitted;
+        visitor.per_kv(Str(row.first.data(), row.first.size()), row.second,
+                       continue_flag);
+        if (!continue_flag)
+          break;
+      }
+      std::vector<std::pair<std::string, const T *>>().swap(rows[i]);
+      {
+        std::lock_guard<std::mutex> lk(m);
+        delivered = i + 1;
+      }
+      cv.notify_all();
+    }
+  }
+
   uint64_t get_version_value(const node_type *n) {
     return n->full_version_value();
   }
 
+protected:
+  /**
+   * Runs job(0) ... job(jobs - 1) spread over the scan workers and waits for
+   * them all. The workers made their threadinfos once, and masstree never
+   * frees one, so one-off parallel work (bulk_load, log replay) runs here
+   * rather than on threads of its own. Shares the pool with parallel scans,
+   * one user at a time.
+   */
+  void run_on_workers(std::size_t jobs,
+                      const std::function<void(std::size_t)> &job) {
+    std::lock_guard<std::mutex> lk(scan_pool_mutex_);
+    WorkerPool &pool = scan_pool();
+    std::size_t step = pool.size();
+    pool.run_all([&](std::size_t w) {
+      for (std::size_t j = w; j < jobs; j += step)
+        job(j);
+      thread_offline();
+    });
+  }
+
 private:
+  // pins the thread's epoch; quiesces before the operation so that pointers
+  // handed out by the previous one stay valid until now
+  void begin_op() const {
+    if (unlikely(!online_))
+      go_online();
+    else if (quiesce_interval_ != 0 && scan_depth_ == 0 &&
+             ++ops_since_quiesce_ >= quiesce_interval_)
+      quiesce();
+  }
+
+  // scan callbacks may call back into the wrapper; never quiesce under a scan
+  struct ScanDepth {
+    ScanDepth() { ++scan_depth_; }
+    ~ScanDepth() { --scan_depth_; }
+  };
+
+  static void go_online() {
+    struct OfflineOnExit {
+      ~OfflineOnExit() { thread_offline(); }
+    };
+    static thread_local OfflineOnExit offline_on_exit;
+    (void)offline_on_exit;
+    ti->rcu_start();
+    online_ = true;
+  }
+
+  using key_type = typename leaf_type::key_type;
+  using nodeversion_type = typename node_type::nodeversion_type;
+  using permuter_type = typename leaf_type::permuter_type;
+
+  WorkerPool &scan_pool() {
+    if (!scan_pool_)
+      scan_pool_.reset(new WorkerPool(
+          std::max(1u, std::thread::hardware_concurrency()),
+          [](std::size_t) { thread_init(-1); }));
+    return *scan_pool_;
+  }
+
+  // adds each leaf a scan visits to a NodeSet
+  template <typename Visitor> struct NodeRecorder {
+    Visitor &visitor;
+    NodeSet &node_set;
+
+    void per_kv(const Str &key, const T *val, bool &continue_flag) {
+      visitor.per_kv(key, val, continue_flag);
+    }
+
+    void per_node(const leaf_type *leaf, uint64_t version,
+                  bool &continue_flag) {
+      if (!node_set.add(leaf, version)) {
+        continue_flag = false;
+        return;
+      }
+      if constexpr (has_per_node<Visitor>::value)
+        visitor.per_node(leaf, version, continue_flag);
+    }
+  };
+
+  // collects a subrange for parallel_scan_ordered
+  struct RowCollector {
+    std::vector<std::pair<std::string, const T *>> &rows;
+    const std::atomic<bool> &cancel;
+
+    void per_kv(const Str &key, const T *val, bool &continue_flag) {
+      rows.emplace_back(std::string(key.s, key.len), val);
+      continue_flag = !cancel.load(std::memory_order_relaxed);
+    }
+  };
+
+  /**
+   * [lkey, rkey] cut at split keys into subranges [lkey, s0), [s0, s1), ...,
+   * [sn, rkey]. Split keys are only hints: any sorted keys strictly inside
+   * the range give the same rows overall, so they are read from internodes
+   * without locking and a node that changes meanwhile is skipped.
+   */
+  class ScanRanges {
+    using ikey_type = typename leaf_type::ikey_type;
+
+  public:
+    ScanRanges(const char *lkey, std::size_t len_lkey, bool l_exclusive,
+               const char *rkey, std::size_t len_rkey, bool r_exclusive)
+        : lkey_(lkey), len_lkey_(len_lkey), l_exclusive_(l_exclusive),
+          rkey_(rkey), len_rkey_(len_rkey), r_exclusive_(r_exclusive) {}
+
+    std::size_t size() const { return splits_.size() + 1; }
+
+    // takes separators level by level until there are at least want of them
+    void split(MasstreeWrapper &mt, std::size_t want) {
+      ikey_type lo = lkey_ ? key_type(lkey_, len_lkey_).ikey() : 0;
+      ikey_type hi = rkey_ ? key_type(rkey_, len_rkey_).ikey() : ~ikey_type(0);
+      std::vector<ikey_type> seps;
+      std::vector<const node_type *> level{mt.table_.fix_root()};
+      std::vector<const node_type *> next;
+      while (!level.empty() && seps.size() < want) {
+        next.clear();
+        for (const node_type *n : level) {
+          if (n->isleaf())
+            continue;
+          const internode_type *in = static_cast<const internode_type *>(n);
+          nodeversion_type v = in->stable();
+          int nkeys = std::min<int>(in->nkeys_, internode_type::width);
+          ikey_type ks[internode_type::width];
+          const node_type *cs[internode_type::width + 1];
+          for (int i = 0; i < nkeys; ++i)
+            ks[i] = in->ikey0_[i];
+          for (int i = 0; i <= nkeys; ++i)
+            cs[i] = in->child_[i];
+          if (in->has_changed(v))
+            continue;
+          // child i holds [ks[i - 1], ks[i])
+          for (int i = 0; i <= nkeys; ++i) {
+            if ((i < nkeys && ks[i] <= lo) || (i > 0 && ks[i - 1] > hi))
+              continue;
+            if (i > 0)
+              seps.push_back(ks[i - 1]);
+            next.push_back(cs[i]);
+          }
+        }
+        level.swap(next);
+      }
+
+      std::sort(seps.begin(), seps.end());
+      seps.erase(std::unique(seps.begin(), seps.end()), seps.end());
+      for (ikey_type ikey : seps) {
+        char buf[sizeof(ikey_type)];
+        ikey_type be = host_to_net_order(ikey);
+        memcpy(buf, &be, sizeof(buf));
+        if ((lkey_ && compare(buf, sizeof(buf), lkey_, len_lkey_) <= 0) ||
+            (rkey_ && compare(buf, sizeof(buf), rkey_, len_rkey_) >= 0))
+          continue;
+        splits_.emplace_back(buf, sizeof(buf));
+      }
+    }
+
+    template <typename Visitor>
+    void scan(MasstreeWrapper &mt, std::size_t i, Visitor &visitor,
+              int64_t max_scan_num) const {
+      bool first = (i == 0);
+      bool last = (i == splits_.size());
+      mt.scan(first ? lkey_ : splits_[i - 1].data(),
+              first ? len_lkey_ : splits_[i - 1].size(),
+              first ? l_exclusive_ : false,
+              last ? rkey_ : splits_[i].data(),
+              last ? len_rkey_ : splits_[i].size(),
+              last ? r_exclusive_ : true, visitor, max_scan_num);
+    }
+
+  private:
+    static int compare(const char *a, std::size_t alen, const char *b,
+                       std::size_t blen) {
+      int c = memcmp(a, b, std::min(alen, blen));
+      return c != 0 ? c : (alen < blen ? -1 : alen > blen);
+    }
+
+    const char *lkey_;
+    std::size_t len_lkey_;
+    bool l_exclusive_;
+    const char *rkey_;
+    std::size_t len_rkey_;
+    bool r_exclusive_;
+    std::vector<std::string> splits_;
+  };
+
+  // a range as scan() takes it, relative to one layer; a null end is open
+  struct CountRange {
+    using ikey_type = typename leaf_type::ikey_type;
+
+    const char *lo = nullptr;
+    std::size_t lo_len = 0;
+    bool lo_exclusive = false;
+    const char *hi = nullptr;
+    std::size_t hi_len = 0;
+    bool hi_exclusive = false;
+    ikey_type lo_ikey = 0;
+    ikey_type hi_ikey = ~ikey_type(0);
+
+    CountRange() = default;
+    CountRange(const char *l, std::size_t l_len, bool l_exclusive,
+               const char *h, std::size_t h_len, bool h_exclusive)
+        : lo(l), lo_len(l_len), lo_exclusive(l_exclusive), hi(h),
+          hi_len(h_len), hi_exclusive(h_exclusive) {
+      if (lo)
+        lo_ikey = key_type(lo, lo_len).ikey();
+      if (hi)
+        hi_ikey = key_type(hi, hi_len).ikey();
+    }
+
+    // the part of the range inside the layer under slice ikey; false if
+    // that layer holds no key of it
+    bool below(ikey_type ikey, CountRange &sub) const {
+      // every key in the layer is longer than its slice
+      bool lo_inside = lo && ikey == lo_ikey && lo_len > 8;
+      if (hi && ikey == hi_ikey && hi_len <= 8)
+        return 0;
+      bool hi_inside = hi && ikey == hi_ikey;
+      sub = CountRange(lo_inside ? lo + 8 : nullptr, lo_inside ? lo_len - 8 : 0,
+                       lo_exclusive, hi_inside ? hi + 8 : nullptr,
+                       hi_inside ? hi_len - 8 : 0, hi_exclusive);
+      return 1;
+    }
+  };
+
+  struct LeafCount {
+    std::size_t keys = 0; // plain keys in the range
+    std::vector<std::pair<const node_type *, CountRange>> layers;
+    int size = 0;
+    const leaf_type *next = nullptr;
+    bool past = false; // the leaf holds keys past the range
+  };
+
+  // slice (its first slice_len bytes) and suffix against key, memcmp order
+  static int compare_parts(const char *slice, std::size_t slice_len,
+                           Str suffix, const char *key, std::size_t len) {
+    int c = memcmp(slice, key, std::min(slice_len, len));
+    if (c != 0)
+      return c;
+    if (len <= slice_len)
+      return slice_len + suffix.len > len;
+    int s = memcmp(suffix.s, key + slice_len,
+                   std::min<std::size_t>(suffix.len, len - slice_len));
+    if (s != 0)
+      return s;
+    return (slice_len + suffix.len > len) - (slice_len + suffix.len < len);
+  }
+
+  enum class SlotInRange { before, key, layer, past };
+
+  // where slot p of leaf n falls against r; sub is set for a layer
+  static SlotInRange slot_in_range(const leaf_type *n, int p,
+                                   const CountRange &r, CountRange &sub) {
+    typename CountRange::ikey_type ikey = n->ikey0_[p];
+    if (ikey < r.lo_ikey)
+      return SlotInRange::before;
+    if (ikey > r.hi_ikey)
+      return SlotInRange::past;
+    int keylenx = n->keylenx_[p];
+    if (leaf_type::keylenx_is_layer(keylenx))
+      return r.below(ikey, sub) ? SlotInRange::layer : SlotInRange::past;
+    if (ikey > r.lo_ikey && ikey < r.hi_ikey)
+      return SlotInRange::key;
+    // the slice is an end key's: compare the key whole
+    uint64_t slice = __builtin_bswap64(ikey);
+    const char *s = reinterpret_cast<const char *>(&slice);
+    std::size_t slice_len = std::min(keylenx, 8);
+    Str suffix =
+        leaf_type::keylenx_has_ksuf(keylenx) ? n->ksuf(p) : Str("", 0);
+    int lc = r.lo ? compare_parts(s, slice_len, suffix, r.lo, r.lo_len) : 1;
+    if (lc < 0 || (lc == 0 && r.lo_exclusive))
+      return SlotInRange::before;
+    int hc = r.hi ? compare_parts(s, slice_len, suffix, r.hi, r.hi_len) : -1;
+    if (hc > 0 || (hc == 0 && r.hi_exclusive))
+      return SlotInRange::past;
+    return SlotInRange::key;
+  }
+
+  // leaf n's keys in r from one consistent read; false if n was removed
+  static bool count_leaf(const leaf_type *n, const CountRange &r,
+                         LeafCount &c) {
+    for (;;) {
+      nodeversion_type v = n->stable();
+      if (v.deleted())
+        return 0;
+      permuter_type perm = n->permutation();
+      c.keys = 0;
+      c.layers.clear();
+      c.size = perm.size();
+      c.past = false;
+      for (int i = 0; i < perm.size(); ++i) {
+        int p = perm[i];
+        CountRange sub;
+        SlotInRange in = slot_in_range(n, p, r, sub);
+        if (in == SlotInRange::past) {
+          c.past = true;
+          break;
+        }
+        if (in == SlotInRange::key)
+          ++c.keys;
+        else if (in == SlotInRange::layer)
+          c.layers.emplace_back(n->lv_[p].layer(), sub);
+      }
+      c.next = n->safe_next();
+      acquire_fence();
+      if (n->full_version_value() ==
+          static_cast<nodeversion_value_type>(
+              (v.version_value() << permuter_type::size_bits) + perm.size()))
+        return 1;
+    }
+  }
+
+  // adds the keys of r in the layer under root; false if a leaf was removed
+  bool count_layer(const node_type *root, const CountRange &r,
+                   std::size_t &count) const {
+    key_type ka(r.lo ? r.lo : "", r.lo ? r.lo_len : 0);
+    nodeversion_type v;
+    const leaf_type *n = root->reach_leaf(ka, v, *ti);
+    LeafCount c;
+    while (n != nullptr) {
+      if (!count_leaf(n, r, c))
+        return 0;
+      count += c.keys;
+      for (const auto &layer : c.layers)
+        if (!count_layer(layer.first, layer.second, count))
+          return 0;
+      n = c.past ? nullptr : c.next;
+    }
+    return 1;
+  }
+
+  // the bytes of slot p's slice that belong to its key
+  static std::string slice_bytes(const leaf_type *n, int p) {
+    uint64_t slice = __builtin_bswap64(n->ikey0_[p]);
+    int len = n->is_layer(p) ? 8 : std::min<int>(n->keylenx_[p], 8);
+    return std::string(reinterpret_cast<const char *>(&slice), len);
+  }
+
+  /**
+   * remove_range() in the layer under root, whose keys all start with
+   * prefix; adds the keys removed to removed. False if a leaf was removed
+   * under it, and the caller goes again.
+   */
+  bool remove_layer(node_type *root, const CountRange &r,
+                    const std::string &prefix, std::size_t &removed) {
+    key_type ka(r.lo ? r.lo : "", r.lo ? r.lo_len : 0);
+    nodeversion_type v;
+    leaf_type *n = root->reach_leaf(ka, v, *ti);
+    struct Layer {
+      node_type *root;
+      CountRange r;
+      std::string prefix;
+    };
+    std::vector<Layer> layers;
+    std::string last;
+    while (n != nullptr) {
+      n->lock();
+      if (n->deleted()) {
+        n->unlock();
+        return 0;
+      }
+      permuter_type perm = n->permutation();
+      int drop[leaf_type::width]; // positions in the range, ascending
+      int ndrop = 0;
+      bool past = false;
+      layers.clear();
+      for (int i = 0; i < perm.size(); ++i) {
+        CountRange sub;
+        SlotInRange in = slot_in_range(n, perm[i], r, sub);
+        if (in == SlotInRange::past) {
+          past = true;
+          break;
+        }
+        if (in == SlotInRange::key)
+          drop[ndrop++] = i;
+        else if (in == SlotInRange::layer)
+          layers.push_back(Layer{n->lv_[perm[i]].layer(), sub,
+                                 prefix + slice_bytes(n, perm[i])});
+      }
+      // an emptied leaf is unlinked by tcursor's remove of its last key
+      bool unlink = ndrop != 0 && ndrop == perm.size();
+      if (unlink) {
+        int p = perm[drop[--ndrop]];
+        last = prefix + slice_bytes(n, p);
+        if (n->has_ksuf(p))
+          last.append(n->ksuf(p).s, n->ksuf(p).len);
+      }
+      if (ndrop != 0) {
+        // as tcursor's finish_remove: readers of the old slots must retry
+        if (n->modstate_ == leaf_type::modstate_insert) {
+          n->mark_insert();
+          n->modstate_ = leaf_type::modstate_remove;
+        }
+        for (int j = ndrop - 1; j >= 0; --j)
+          perm.remove(drop[j]);
+        n->permutation_ = perm.value();
+        removed += ndrop;
+      }
+      leaf_type *next = past ? nullptr : n->safe_next();
+      n->unlock();
+
+      for (const Layer &layer : layers)
+        if (!remove_layer(layer.root, layer.r, layer.prefix, removed))
+          return 0;
+      if (unlink) {
+        cursor_type lp(table_, last.data(), last.size());
+        bool found = lp.find_locked(*ti);
+        lp.finish(found ? -1 : 0, *ti);
+        removed += found;
+      }
+      n = next;
+    }
+    return 1;
+  }
+
+  /**
+   * Whether every row of the leaf a scan is at (as of its permutation
+   * snapshot) lies strictly before end, or strictly after it if !forward.
+   * False, so that rows are compared one by one, whenever the leaf no longer
+   * matches the version the scan validated.
+   * ka is the scan's key, whose first prefix_length() bytes are the layer's
+   * prefix. A layer below the leaf shares its slot's side of end, so this
+   * also holds for the layers the scan descends into from here.
+   */
+  template <typename ScanStackElt, typename Key>
+  static bool leaf_inside_bound(const ScanStackElt &iter, const Key &ka,
+                                const char *end, std::size_t len_end,
+                                bool forward) {
+    typename ScanStackElt::permuter_type perm = iter.permutation();
+    if (perm.size() == 0)
+      return 0;
+    std::size_t prefix_len = ka.prefix_length();
+    int c = memcmp(ka.full_string().s, end, std::min(prefix_len, len_end));
+    if (c != 0)
+      return forward ? c < 0 : c > 0;
+    // every key of a layer is longer than the layer's prefix
+    if (len_end <= prefix_len)
+      return !forward && (len_end < prefix_len || prefix_len > 0);
+    // a smaller slice is a smaller key, whatever follows either
+    typename leaf_type::ikey_type end_ikey =
+        key_type(end + prefix_len, len_end - prefix_len).ikey();
+    const leaf_type *n = iter.node();
+    typename leaf_type::ikey_type edge =
+        n->ikey0_[forward ? perm[perm.size() - 1] : perm[0]];
+    // the slot may have been reused since the scan read the leaf; if the
+    // leaf changed at all, compare row by row
+    acquire_fence();
+    if (n->full_version_value() != iter.full_version_value())
+      return 0;
+    return forward ? edge < end_ikey : edge > end_ikey;
+  }
+
+  // an internode's keys and children from one consistent read
+  struct InternodeCopy {
+    using ikey_type = typename leaf_type::ikey_type;
+
+    int nkeys = 0;
+    ikey_type ks[internode_type::width];
+    const node_type *cs[internode_type::width + 1];
+
+    explicit InternodeCopy(const node_type *n) {
+      const internode_type *in = static_cast<const internode_type *>(n);
+      for (;;) {
+        nodeversion_type v = in->stable();
+        nkeys = std::min<int>(in->nkeys_, internode_type::width);
+        for (int i = 0; i < nkeys; ++i)
+          ks[i] = in->ikey0_[i];
+        for (int i = 0; i <= nkeys; ++i)
+          cs[i] = in->child_[i];
+        if (!in->has_changed(v))
+          return;
+      }
+    }
+
+    // the child holding ikey; child i holds [ks[i - 1], ks[i])
+    int index(ikey_type ikey) const {
+      return static_cast<int>(std::upper_bound(ks, ks + nkeys, ikey) - ks);
+    }
+  };
+
+  // estimate_range() in the layer under root; budget caps the leaves read
+  double estimate_layer(const node_type *root, const CountRange &r,
+                        int &budget) const {
+    if (r.lo_ikey > r.hi_ikey)
+      return 0;
+    const node_type *ln = root;
+    // a layer's root may have split since the slot naming it was read
+    while (!ln->stable().is_root())
+      ln = ln->maybe_parent();
+    const node_type *rn = ln;
+
+    // by depth: fanout seen, and whole subtrees between the two paths
+    std::vector<double> fanout;
+    std::vector<int> subtrees;
+    while (!ln->isleaf() && !rn->isleaf()) {
+      InternodeCopy l(ln);
+      int il = l.index(r.lo_ikey);
+      if (ln == rn) {
+        int ir = l.index(r.hi_ikey);
+        fanout.push_back(l.nkeys + 1);
+        subtrees.push_back(std::max(ir - il - 1, 0));
+        rn = l.cs[ir];
+      } else {
+        InternodeCopy h(rn);
+        int ir = h.index(r.hi_ikey);
+        fanout.push_back((l.nkeys + h.nkeys + 2) / 2.0);
+        subtrees.push_back(l.nkeys - il + ir);
+        rn = h.cs[ir];
+      }
+      ln = l.cs[il];
+    }
+
+    double estimate = 0;
+    double leaf_size = 0;
+    int leaves = 0;
+    auto count_boundary = [&](const node_type *n) {
+      LeafCount c;
+      if (!n->isleaf() || !count_leaf(static_cast<const leaf_type *>(n), r, c))
+        return;
+      --budget;
+      estimate += c.keys;
+      for (const auto &layer : c.layers)
+        estimate += budget > 0
+                        ? estimate_layer(layer.first, layer.second, budget)
+                        : 1;
+      leaf_size += c.size;
+      ++leaves;
+    };
+    count_boundary(ln);
+    if (rn != ln)
+      count_boundary(rn);
+    if (leaves > 0)
+      leaf_size /= leaves;
+
+    // a subtree hanging off depth d is rooted at depth d + 1
+    double size = leaf_size;
+    for (std::size_t d = subtrees.size(); d-- > 0;) {
+      estimate += subtrees[d] * size;
+      size *= fanout[d];
+    }
+    return estimate;
+  }
+
+  static std::size_t node_lines(std::size_t size) {
+    return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  }
+
+  /**
+   * Where a stats() walk stands. A node's lower bound is the key its range
+   * starts at: the slices of the layers above it, then its own first slice.
+   * The walk counts only nodes whose lower bound is at least resume (those
+   * before it were counted by an earlier piece) and skips subtrees that end
+   * at or before it.
+   */
+  struct StatsWalk {
+    TreeStats &s;
+    std::string resume;
+    uint64_t budget = 0; // leaves this piece may still count
+    bool stopped = 0;    // resume is where the next piece starts
+  };
+
+  static std::string append_slice(const std::string &prefix,
+                                  typename leaf_type::ikey_type ikey) {
+    std::string key = prefix;
+    uint64_t slice = __builtin_bswap64(ikey);
+    key.append(reinterpret_cast<const char *>(&slice), sizeof(slice));
+    return key;
+  }
+
+  // adds the layer under root, d layers down, and the layers below it;
+  // prefix is the key bytes the layer's keys start with
+  void stats_layer(const node_type *root, std::size_t d,
+                   const std::string &prefix, StatsWalk &w) const {
+    while (!root->stable().is_root())
+      root = root->maybe_parent();
+    if (w.s.layers.size() <= d)
+      w.s.layers.resize(d + 1);
+    if (prefix >= w.resume)
+      ++w.s.layers[d].trees;
+    std::vector<uint64_t> levels; // from the root down
+    stats_node(root, d, 0, prefix, prefix, levels, w);
+    std::vector<uint64_t> &by_height = w.s.layers[d].levels;
+    if (by_height.size() < levels.size())
+      by_height.resize(levels.size());
+    for (std::size_t h = 0; h < levels.size(); ++h)
+      by_height[h] += levels[levels.size() - 1 - h];
+  }
+
+  void stats_node(const node_type *n, std::size_t d, std::size_t level,
+                  const std::string &prefix, const std::string &lo,
+                  std::vector<uint64_t> &levels, StatsWalk &w) const {
+    TreeStats &s = w.s;
+    bool count = lo >= w.resume;
+    if (levels.size() <= level)
+      levels.resize(level + 1);
+    levels[level] += count;
+    TreeStats::Layer &layer = s.layers[d];
+    if (!n->isleaf()) {
+      InternodeCopy in(n);
+      if (count) {
+        ++layer.internodes;
+        ++s.internode_fill[in.nkeys + 1];
+      }
+      std::string child_lo = lo;
+      for (int i = 0; i <= in.nkeys; ++i) {
+        std::string hi =
+            i < in.nkeys ? append_slice(prefix, in.ks[i]) : std::string();
+        if (i < in.nkeys && hi <= w.resume) {
+          child_lo = std::move(hi); // counted by an earlier piece
+          continue;
+        }
+        // a first child starts where its parent does; never stop there
+        if (i > 0 && w.budget == 0 && child_lo > w.resume) {
+          w.resume = std::move(child_lo);
+          w.stopped = 1;
+          return;
+        }
+        stats_node(in.cs[i], d, level + 1, prefix, child_lo, levels, w);
+        if (w.stopped)
+          return;
+        child_lo = std::move(hi);
+      }
+      return;
+    }
+
+    const leaf_type *leaf = static_cast<const leaf_type *>(n);
+    std::vector<std::pair<typename leaf_type::ikey_type, const node_type *>>
+        below;
+    uint64_t keys, suffix_keys, suffix_bytes;
+    int size;
+    for (;;) {
+      nodeversion_type v = leaf->stable();
+      if (v.deleted())
+        return;
+      permuter_type perm = leaf->permutation();
+      size = perm.size();
+      keys = suffix_keys = suffix_bytes = 0;
+      below.clear();
+      for (int i = 0; i < size; ++i) {
+        int p = perm[i];
+        int keylenx = leaf->keylenx_[p];
+        if (leaf_type::keylenx_is_layer(keylenx)) {
+          below.emplace_back(leaf->ikey0_[p], leaf->lv_[p].layer());
+          continue;
+        }
+        ++keys;
+        if (leaf_type::keylenx_has_ksuf(keylenx)) {
+          ++suffix_keys;
+          suffix_bytes += leaf->ksuf(p).len;
+        }
+      }
+      acquire_fence();
+      if (leaf->full_version_value() ==
+          static_cast<nodeversion_value_type>(
+              (v.version_value() << permuter_type::size_bits) + size))
+        break;
+    }
+    if (count) {
+      ++layer.leaves;
+      ++s.leaf_fill[size];
+      layer.keys += keys;
+      layer.layer_slots += below.size();
+      layer.suffix_keys += suffix_keys;
+      layer.suffix_bytes += suffix_bytes;
+      if (w.budget != 0)
+        --w.budget;
+    }
+    // layer is not used past here: stats_layer() may grow s.layers
+    for (const auto &slot : below) {
+      std::string sub = append_slice(prefix, slot.first);
+      if (w.resume.compare(0, sub.size(), sub) > 0)
+        continue; // every key in the layer is before resume
+      stats_layer(slot.second, d + 1, sub, w);
+      if (w.stopped)
+        return;
+    }
+  }
+
+  struct BulkEntry {
+    const char *key;
+    int len;
+    T *value;
+
+    // the ikey of this key's slice in the layer that starts at offset off
+    typename leaf_type::ikey_type slice(int off) const {
+      return key_type(key + off, len - off).ikey();
+    }
+
+    static bool less(const BulkEntry &a, const BulkEntry &b) {
+      int c = memcmp(a.key, b.key, std::min(a.len, b.len));
+      return c < 0 || (c == 0 && a.len < b.len);
+    }
+  };
+
+  /**
+   * Inserts e into n, a locked leaf of the top layer, the way tcursor's
+   * find_insert and finish_insert would: 1 if inserted, 0 if the key is
+   * there already, -1 if e belongs to another leaf or needs a split, a new
+   * layer or a bigger suffix bag. The new slot only becomes visible with
+   * the permutation.
+   */
+  int insert_locked(leaf_type *n, const BulkEntry &e) {
+    key_type ka(e.key, e.len);
+    const leaf_type *next = n->safe_next();
+    if ((n->prev_ && ka.ikey() < n->ikey_bound()) ||
+        (next && ka.ikey() >= next->ikey_bound()))
+      return -1;
+    permuter_type perm = n->permutation();
+    Masstree::key_indexed_position kx =
+        leaf_type::bound_type::lower(ka, LeafView{n, perm});
+    if (kx.p >= 0) // the slice is taken: the same key, a suffix or a layer
+      return n->ksuf_matches(kx.p, ka) > 0 ? 0 : -1;
+    if (perm.size() == leaf_type::width)
+      return -1;
+    int p = perm.back();
+    // slot 0 holds the leaf's bound and is only reused for the same slice
+    if (p == 0 && n->prev_ && n->ikey_bound() != ka.ikey())
+      return -1;
+    if (ka.has_suffix()) {
+      Str suffix = ka.suffix();
+      if (!(n->ksuf_ ? n->ksuf_->assign(p, suffix)
+                     : n->extrasize64_ > 0 && n->iksuf_[0].assign(p, suffix)))
+        return -1;
+    }
+    n->ikey0_[p] = ka.ikey();
+    n->keylenx_[p] = ka.has_suffix() ? leaf_type::ksuf_keylenx : ka.length();
+    n->lv_[p] = typename leaf_type::leafvalue_type(e.value);
+    perm.insert_from_back(kx.i);
+    fence();
+    n->permutation_ = perm.value();
+    return 1;
+  }
+
+  // builds nodes from sorted, unique entries with one thread's threadinfo
+  class BulkLoader {
+    using ikey_type = typename leaf_type::ikey_type;
+    using leafvalue_type = typename leaf_type::leafvalue_type;
+    using ksuf_type = typename leaf_type::external_ksuf_type;
+
+  public:
+    BulkLoader(double fill_factor, typename table_params::threadinfo_type &ti)
+        : ti_(ti),
+          leaf_fill_(std::clamp(
+              static_cast<int>(leaf_type::width * fill_factor + 0.5), 1,
+              leaf_type::width)),
+          // at least 3 so that even splitting never leaves a lone child
+          internode_fill_(std::clamp(
+              static_cast<int>((internode_type::width + 1) * fill_factor +
+                               0.5),
+              3, internode_type::width + 1)) {}
+
+    /**
+     * Appends to out the leaves holding [b, e) in the layer whose keys start
+     * at offset off, filling first before allocating any. Keys of one slice
+     * always share a leaf: the short ones each take a slot, and the long ones
+     * take one more between them, as a key suffix or a new layer.
+     */
+    void build_leaves(const BulkEntry *b, const BulkEntry *e, int off,
+                      leaf_type *first, std::vector<node_type *> &out) {
+      leaf_type *leaf = first ? first : make_leaf();
+      std::vector<std::pair<int, Str>> suffixes;
+      int n = 0;
+      for (const BulkEntry *p = b; p != e;) {
+        ikey_type ikey = p->slice(off);
+        const BulkEntry *lb = p; // start of the keys longer than the slice
+        while (lb != e && lb->len - off <= key_type::ikey_size &&
+               lb->slice(off) == ikey)
+          ++lb;
+        const BulkEntry *le = lb;
+        while (le != e && le->slice(off) == ikey)
+          ++le;
+
+        int slots = static_cast<int>(lb - p) + (le != lb);
+        if (n != 0 && n + slots > leaf_fill_) {
+          finish_leaf(leaf, n, suffixes);
+          out.push_back(leaf);
+          leaf = make_leaf();
+          n = 0;
+        }
+        for (; p != lb; ++p, ++n) {
+          leaf->ikey0_[n] = ikey;
+          leaf->keylenx_[n] = p->len - off;
+          leaf->lv_[n] = leafvalue_type(p->value);
+        }
+        if (le - lb == 1) {
+          leaf->ikey0_[n] = ikey;
+          leaf->keylenx_[n] = leaf_type::ksuf_keylenx;
+          leaf->lv_[n] = leafvalue_type(lb->value);
+          int sufoff = off + key_type::ikey_size;
+          suffixes.emplace_back(n++, Str(lb->key + sufoff, lb->len - sufoff));
+        } else if (le - lb > 1) {
+          leaf->ikey0_[n] = ikey;
+          leaf->keylenx_[n] = leaf_type::layer_keylenx;
+          leaf->lv_[n++] =
+              leafvalue_type(build_layer(lb, le, off + key_type::ikey_size));
+        }
+        p = le;
+      }
+      finish_leaf(leaf, n, suffixes);
+      out.push_back(leaf);
+    }
+
+    // builds a whole layer and returns its root
+    node_type *build_layer(const BulkEntry *b, const BulkEntry *e, int off) {
+      std::vector<node_type *> level;
+      build_leaves(b, e, off, nullptr, level);
+      return build_upper(level);
+    }
+
+    /**
+     * Links the leaves in level and stacks internodes on them until one node
+     * is left, which is marked as the layer's root and returned. level ends
+     * up holding that node.
+     */
+    node_type *build_upper(std::vector<node_type *> &level) {
+      for (std::size_t i = 0; i + 1 < level.size(); ++i) {
+        leaf_type *l = static_cast<leaf_type *>(level[i]);
+        leaf_type *r = static_cast<leaf_type *>(level[i + 1]);
+        l->next_.ptr = r;
+        r->prev_ = l;
+      }
+
+      std::vector<ikey_type> bounds;
+      for (node_type *n : level)
+        bounds.push_back(static_cast<leaf_type *>(n)->ikey0_[0]);
+      std::vector<node_type *> next_level;
+      std::vector<ikey_type> next_bounds;
+      for (uint32_t height = 1; level.size() > 1; ++height) {
+        std::size_t n = level.size();
+        std::size_t nodes = (n + internode_fill_ - 1) / internode_fill_;
+        next_level.clear();
+        next_bounds.clear();
+        for (std::size_t i = 0, c = 0; i < nodes; ++i) {
+          std::size_t k = n / nodes + (i < n % nodes);
+          internode_type *in = internode_type::make(height, ti_);
+          in->child_[0] = level[c];
+          level[c]->set_parent(in);
+          for (std::size_t j = 1; j < k; ++j) {
+            in->ikey0_[j - 1] = bounds[c + j];
+            in->child_[j] = level[c + j];
+            level[c + j]->set_parent(in);
+          }
+          in->nkeys_ = k - 1;
+          next_level.push_back(in);
+          next_bounds.push_back(bounds[c]);
+          c += k;
+        }
+        level.swap(next_level);
+        bounds.swap(next_bounds);
+      }
+      level[0]->mark_root();
+      return level[0];
+    }
+
+  private:
+    leaf_type *make_leaf() {
+      return leaf_type::make(0, typename leaf_type::phantom_epoch_type(), ti_);
+    }
+
+    void finish_leaf(leaf_type *leaf, int n,
+                     std::vector<std::pair<int, Str>> &suffixes) {
+      leaf->permutation_ = permuter_type::make_sorted(n);
+      if (suffixes.empty())
+        return;
+      std::size_t len = 0;
+      for (auto &s : suffixes)
+        len += s.second.len;
+      std::size_t sz = ksuf_type::safe_size(leaf_type::width, len);
+      void *ptr = ti_.allocate(sz, memtag_masstree_ksuffixes);
+      ksuf_type *ksuf = new (ptr) ksuf_type(leaf_type::width, sz);
+      for (auto &s : suffixes)
+        ksuf->assign(s.first, s.second);
+      leaf->ksuf_ = ksuf;
+      suffixes.clear();
+    }
+
+    typename table_params::threadinfo_type &ti_;
+    const int leaf_fill_;
+    const int internode_fill_;
+  };
+
+  struct MultiGetLookup {
+    bool idle = true;
+    std::size_t index = 0;
+    key_type ka;
+    // a node is entered through parent; parent_v is rechecked once the node's
+    // own version is known. No parent: the node must be a layer root.
+    const node_type *parent = nullptr;
+    nodeversion_type parent_v;
+    const node_type *node = nullptr;
+    T *result = nullptr;
+    bool found = false;
+
+    void start(std::size_t i, const char *const *keys, const std::size_t *lens,
+               const node_type *root) {
+      idle = false;
+      index = i;
+      ka = key_type(keys[i], lens[i]);
+      parent = nullptr;
+      node = root;
+      prefetch_node(root);
+    }
+  };
+
+  // what leaf_type::bound_type needs, over a snapshot of the permutation
+  struct LeafView {
+    using permuter_type = typename leaf_type::permuter_type;
+    const leaf_type *n;
+    permuter_type perm;
+
+    int size() const { return perm.size(); }
+    permuter_type permutation() const { return perm; }
+    int compare_key(const key_type &a, int bp) const {
+      return n->compare_key(a, bp);
+    }
+  };
+
+  static void prefetch_node(const node_type *n) {
+    // a node's version, keys and child pointers sit in its first 4 lines
+    for (int i = 0; i < 4 * CACHE_LINE_SIZE; i += CACHE_LINE_SIZE)
+      ::prefetch(reinterpret_cast<const char *>(n) + i);
+  }
+
+  // advances lk by one node; true once lk has its result
+  bool multi_get_step(MultiGetLookup &lk, const char *const *keys,
+                      const std::size_t *lens) {
+    nodeversion_type v = lk.node->stable();
+    if (lk.parent ? lk.parent->has_changed(lk.parent_v) : !v.is_root())
+      return multi_get_fallback(lk, keys, lens);
+
+    if (!v.isleaf()) {
+      const internode_type *in = static_cast<const internode_type *>(lk.node);
+      int kp = internode_type::bound_type::upper(lk.ka, *in);
+      const node_type *child = in->child_[kp];
+      if (child == nullptr)
+        return multi_get_fallback(lk, keys, lens);
+      prefetch_node(child);
+      lk.parent = in;
+      lk.parent_v = v;
+      lk.node = child;
+      return false;
+    }
+
+    const leaf_type *leaf = static_cast<const leaf_type *>(lk.node);
+    if (v.deleted())
+      return multi_get_fallback(lk, keys, lens);
+    LeafView view{leaf, leaf->permutation()};
+    Masstree::key_indexed_position kx =
+        leaf_type::bound_type::lower(lk.ka, view);
+    typename leaf_type::leafvalue_type lv;
+    int match = 0;
+    if (kx.p >= 0) {
+      lv = leaf->lv_[kx.p];
+      match = leaf->ksuf_matches(kx.p, lk.ka);
+    }
+    if (leaf->has_changed(v))
+      return multi_get_fallback(lk, keys, lens);
+
+    if (match < 0) { // descend into the next layer
+      lk.ka.shift_by(-match);
+      lk.parent = nullptr;
+      lk.node = lv.layer();
+      prefetch_node(lk.node);
+      return false;
+    }
+    lk.found = (match > 0);
+    lk.result = lk.found ? lv.value() : nullptr;
+    return true;
+  }
+
+  bool multi_get_fallback(MultiGetLookup &lk, const char *const *keys,
+                          const std::size_t *lens) {
+    unlocked_cursor_type lp(table_, keys[lk.index], lens[lk.index]);
+    lk.found = lp.find_unlocked(*ti);
+    lk.result = lk.found ? lp.value() : nullptr;
+    return true;
+  }
+
+  static __thread bool online_;
+  static __thread uint64_t ops_since_quiesce_;
+  static __thread int scan_depth_;
+  // bumped whenever pointers this thread read from the tree may be freed
+  static __thread uint64_t rcu_generation_;
+
   table_type table_;
+  EpochReclaimer reclaimer_;
+  uint64_t quiesce_interval_ = 0;
+  ScanBoundCheck scan_bound_check_ = ScanBoundCheck::per_leaf;
+  std::unique_ptr<WorkerPool> scan_pool_;
+  std::mutex scan_pool_mutex_;
 };
 
-template <typename T>
-__thread typename MasstreeWrapper<T>::table_params::threadinfo_type
-    *MasstreeWrapper<T>::ti = nullptr;
+template <typename T, int LW, int IW>
+__thread typename MasstreeWrapper<T, LW, IW>::table_params::threadinfo_type
+    *MasstreeWrapper<T, LW, IW>::ti = nullptr;
+template <typename T, int LW, int IW>
+__thread bool MasstreeWrapper<T, LW, IW>::online_ = false;
+template <typename T, int LW, int IW>
+__thread uint64_t MasstreeWrapper<T, LW, IW>::ops_since_quiesce_ = 0;
+template <typename T, int LW, int IW>
+__thread int MasstreeWrapper<T, LW, IW>::scan_depth_ = 0;
+template <typename T, int LW, int IW>
+__thread uint64_t MasstreeWrapper<T, LW, IW>::rcu_generation_ = 0;
 // #ifdef GLOBAL_VALUE_DEFINE
 // volatile mrcu_epoch_type active_epoch = 1;
 // volatile std::uint64_t globalepoch = 1;
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Leaf versions observed by a transaction, for Silo-style phantom detection
+ * (section 4.6 of the Silo paper): a range or absent key read records the
+ * leaves it covered, and the transaction commits only if none of them changed
+ * since. The first InlineCapacity entries live in the object itself and are
+ * searched linearly, so the usual short transaction never allocates; past
+ * that the entries move to a vector indexed by an open-addressing table.
+ *
+ * Node is the leaf type, which provides full_version_value(). Seeing a
+ * recorded node again with a different version makes the set conflicted for
+ * good: add() returns false and validate() fails.
+ */
+template <typename Node, std::size_t InlineCapacity = 16> class BasicNodeSet {
+public:
+  struct Entry {
+    const Node *node;
+    uint64_t version;
+  };
+
+  // records node at version; false if it was recorded at another version
+  bool add(const Node *node, uint64_t version) {
+    if (Entry *e = find(node)) {
+      if (e->version != version)
+        conflict_ = true;
+      return !conflict_;
+    }
+    push(Entry{node, version});
+    return !conflict_;
+  }
+
+  /**
+   * Follows the transaction's own insert into node, which moved its version
+   * from old_version to new_version. Nodes not in the set are left out; a
+   * recorded version other than old_version means someone else got there
+   * first, and the set becomes conflicted.
+   */
+  bool update(const Node *node, uint64_t old_version, uint64_t new_version) {
+    if (Entry *e = find(node)) {
+      if (e->version == old_version)
+        e->version = new_version;
+      else
+        conflict_ = true;
+    }
+    return !conflict_;
+  }
+
+  // true if every recorded node still has the version it was recorded at
+  bool validate() const {
+    if (conflict_)
+      return false;
+    bool ok = true;
+    for (const Entry &e : *this)
+      ok &= (e.node->full_version_value() == e.version);
+    return ok;
+  }
+
+  bool conflicted() const { return conflict_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // keeps the spilled storage for reuse by the next transaction
+  void clear() {
+    size_ = 0;
+    conflict_ = false;
+    spill_.clear();
+  }
+
+  const Entry *begin() const { return entries(); }
+  const Entry *end() const { return entries() + size_; }
+
+private:
+  bool spilled() const { return !spill_.empty(); }
+
+  const Entry *entries() const { return spilled() ? spill_.data() : inline_; }
+
+  static std::size_t hash(const Node *node) {
+    // nodes are cache-line aligned; the low bits say nothing
+    uint64_t h = (reinterpret_cast<uintptr_t>(node) >> 6) *
+                 UINT64_C(0x9e3779b97f4a7c15);
+    return h ^ (h >> 32);
+  }
+
+  Entry *find(const Node *node) {
+    if (!spilled()) {
+      for (std::size_t i = 0; i < size_; ++i)
+        if (inline_[i].node == node)
+          return &inline_[i];
+      return nullptr;
+    }
+    std::size_t mask = index_.size() - 1;
+    for (std::size_t s = hash(node) & mask; index_[s] != 0;
+         s = (s + 1) & mask)
+      if (spill_[index_[s] - 1].node == node)
+        return &spill_[index_[s] - 1];
+    return nullptr;
+  }
+
+  void push(const Entry &e) {
+    if (!spilled() && size_ < InlineCapacity) {
+      inline_[size_++] = e;
+      return;
+    }
+    if (!spilled())
+      spill_.assign(inline_, inline_ + size_);
+    spill_.push_back(e);
+    ++size_;
+    if (2 * size_ > index_.size())
+      rehash(std::max<std::size_t>(4 * InlineCapacity, 4 * size_));
+    else if (size_ == InlineCapacity + 1)
+      rehash(index_.size()); // stale from an earlier spill
+    else
+      insert_index(size_ - 1);
+  }
+
+  void rehash(std::size_t capacity) {
+    std::size_t c = 1;
+    while (c < capacity)
+      c <<= 1;
+    index_.assign(c, 0);
+    for (std::size_t i = 0; i < size_; ++i)
+      insert_index(i);
+  }
+
+  void insert_index(std::size_t i) {
+    std::size_t mask = index_.size() - 1;
+    std::size_t s = hash(spill_[i].node) & mask;
+    while (index_[s] != 0)
+      s = (s + 1) & mask;
+    index_[s] = static_cast<uint32_t>(i + 1);
+  }
+
+  Entry inline_[InlineCapacity];
+  std::size_t size_ = 0;
+  bool conflict_ = false;
+  std::vector<Entry> spill_;    // every entry, once past InlineCapacity
+  std::vector<uint32_t> index_; // slots of spill_ + 1; 0 is empty
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+/**
+ * Where worker threads run and where their memory comes from on NUMA
+ * machines. Placement goes through the sched_setaffinity, set_mempolicy and
+ * mbind system calls directly, so nothing needs libnuma at build or run
+ * time. On a single-node machine (or without /sys) threads are still pinned
+ * and the memory policies are left alone.
+ */
+
+// how thread ids map to CPUs
+enum class CpuAffinity {
+  none,    // not pinned, the scheduler decides
+  compact, // fill the first node's CPUs, then the next node's, ...
+  scatter, // round-robin over the nodes
+};
+
+inline CpuAffinity parse_cpu_affinity(const std::string &s) {
+  if (s == "compact")
+    return CpuAffinity::compact;
+  if (s == "scatter")
+    return CpuAffinity::scatter;
+  return CpuAffinity::none;
+}
+
+inline const char *cpu_affinity_name(CpuAffinity a) {
+  switch (a) {
+  case CpuAffinity::compact:
+    return "compact";
+  case CpuAffinity::scatter:
+    return "scatter";
+  default:
+    return "none";
+  }
+}
+
+/**
+ * NUMA nodes that have CPUs this process may run on, read once from
+ * /sys/devices/system/node. Without it every allowed CPU counts as node 0.
+ * Node ids are the kernel's; they may have holes.
+ */
+class NumaTopology {
+public:
+  static const NumaTopology &get() {
+    static const NumaTopology topology;
+    return topology;
+  }
+
+  std::size_t nodes() const { return node_ids_.size(); }
+  int node_id(std::size_t i) const { return node_ids_[i]; }
+  const std::vector<int> &cpus(std::size_t i) const { return node_cpus_[i]; }
+
+  int node_of_cpu(int cpu) const {
+    return cpu >= 0 && cpu < static_cast<int>(cpu_node_.size()) ? cpu_node_[cpu]
+                                                                  : -1;
+  }
+
+  // the CPU thread_id runs on under affinity; -1 for CpuAffinity::none
+  int cpu_for_thread(int thread_id, CpuAffinity affinity) const {
+    if (affinity == CpuAffinity::none || thread_id < 0)
+      return -1;
+    const std::vector<int> &order =
+        affinity == CpuAffinity::compact ? compact_ : scatter_;
+    return order[thread_id % order.size()];
+  }
+
+private:
+  NumaTopology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      for (int c = 0; c < CPU_SETSIZE; ++c)
+        CPU_SET(c, &allowed);
+
+    for (int node : read_list("/sys/devices/system/node/online")) {
+      std::vector<int> cpus;
+      for (int c : read_list("/sys/devices/system/node/node" +
+                             std::to_string(node) + "/cpulist"))
+        if (c < CPU_SETSIZE && CPU_ISSET(c, &allowed))
+          cpus.push_back(c);
+      if (!cpus.empty()) // memory-only nodes have no threads to place
+        add_node(node, std::move(cpus));
+    }
+    if (node_ids_.empty()) {
+      std::vector<int> cpus;
+      for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &allowed))
+          cpus.push_back(c);
+      add_node(0, cpus.empty() ? std::vector<int>{0} : std::move(cpus));
+    }
+
+    for (const std::vector<int> &cpus : node_cpus_)
+      compact_.insert(compact_.end(), cpus.begin(), cpus.end());
+    for (std::size_t i = 0; scatter_.size() < compact_.size(); ++i)
+      for (const std::vector<int> &cpus : node_cpus_)
+        if (i < cpus.size())
+          scatter_.push_back(cpus[i]);
+  }
+
+  void add_node(int node, std::vector<int> cpus) {
+    for (int c : cpus) {
+      if (c >= static_cast<int>(cpu_node_.size()))
+        cpu_node_.resize(c + 1, -1);
+      cpu_node_[c] = node;
+    }
+    node_ids_.push_back(node);
+    node_cpus_.push_back(std::move(cpus));
+  }
+
+  // a sysfs list such as "0-3,8,10-11"; empty if the file is missing
+  static std::vector<int> read_list(const std::string &path) {
+    std::vector<int> list;
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr)
+      return list;
+    char buf[4096];
+    const char *s = fgets(buf, sizeof(buf), f) ? buf : "";
+    fclose(f);
+    while (*s != '\0' && *s != '\n') {
+      char *end;
+      long first = strtol(s, &end, 10);
+      if (end == s)
+        break;
+      long last = first;
+      if (*end == '-')
+        last = strtol(end + 1, &end, 10);
+      for (long i = first; i <= last; ++i)
+        list.push_back(static_cast<int>(i));
+      s = (*end == ',') ? end + 1 : end;
+    }
+    return list;
+  }
+
+  std::vector<int> node_ids_;
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<int> cpu_node_; // by CPU; -1 if not allowed
+  std::vector<int> compact_;
+  std::vector<int> scatter_;
+};
+
+// node mask in the layout set_mempolicy and mbind take
+struct NodeMask {
+  static constexpr std::size_t max_nodes = 1024;
+  unsigned long bits[max_nodes / (8 * sizeof(unsigned long))] = {};
+
+  void set(int node) {
+    if (node >= 0 && static_cast<std::size_t>(node) < max_nodes)
+      bits[node / (8 * sizeof(unsigned long))] |=
+          1UL << (node % (8 * sizeof(unsigned long)));
+  }
+};
+
+/**
+ * Pins the calling thread to cpu and, on a multi-node machine, makes it
+ * prefer its node's memory: pages it touches first, masstree's pools and
+ * malloc'd values alike, come from that node while it has free memory.
+ * False if the thread could not be pinned.
+ */
+inline bool bind_thread_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    return 0;
+  const NumaTopology &topology = NumaTopology::get();
+  if (topology.nodes() > 1) {
+    NodeMask mask;
+    mask.set(topology.node_of_cpu(cpu));
+    // a failure only leaves the default (first-touch) policy in place
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.bits, NodeMask::max_nodes);
+  }
+  return 1;
+}
+
+/**
+ * Memory for internodes, interleaved page by page over every node. Every
+ * lookup from every thread walks the same internodes, so they are better
+ * spread over the nodes than packed onto whichever node happened to split
+ * them; leaves stay in the pools of the threads that created them.
+ *
+ * The arena is one address range reserved up front and handed out in cache
+ * lines; freed blocks go to per-size free lists and are never unmapped.
+ * enable() fails on single-node machines and when the range cannot be
+ * reserved, and the tree keeps using masstree's pools.
+ */
+class InternodeArena {
+public:
+  static InternodeArena &get() {
+    static InternodeArena arena;
+    return arena;
+  }
+
+  // internodes made from now on come from the arena
+  bool enable(std::size_t reserve_bytes = std::size_t(1) << 34) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (enabled_.load(std::memory_order_relaxed))
+      return 1;
+    const NumaTopology &topology = NumaTopology::get();
+    if (topology.nodes() < 2)
+      return 0;
+    void *p = mmap(nullptr, reserve_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+      return 0;
+    NodeMask mask;
+    for (std::size_t i = 0; i < topology.nodes(); ++i)
+      mask.set(topology.node_id(i));
+    if (syscall(SYS_mbind, p, reserve_bytes, MPOL_INTERLEAVE, mask.bits,
+                NodeMask::max_nodes, 0) != 0) {
+      munmap(p, reserve_bytes);
+      return 0;
+    }
+    base_ = static_cast<char *>(p);
+    next_ = base_;
+    end_ = base_ + reserve_bytes;
+    enabled_.store(true, std::memory_order_release);
+    return 1;
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_acquire); }
+
+  bool owns(const void *p) const {
+    return enabled() && p >= base_ && p < end_;
+  }
+
+  // nullptr once the range is used up; the caller falls back to its pool
+  void *allocate(std::size_t size) {
+    std::size_t lines = (size + line_size - 1) / line_size;
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (lines <= max_lines && free_[lines - 1] != nullptr) {
+      FreeBlock *b = free_[lines - 1];
+      free_[lines - 1] = b->next;
+      return b;
+    }
+    std::size_t bytes = lines * line_size;
+    if (static_cast<std::size_t>(end_ - next_) < bytes)
+      return nullptr;
+    void *p = next_;
+    next_ += bytes;
+    return p;
+  }
+
+  void deallocate(void *p, std::size_t size) {
+    std::size_t lines = (size + line_size - 1) / line_size;
+    if (lines > max_lines)
+      return; // not reused; internodes are far smaller
+    std::lock_guard<std::mutex> lk(mutex_);
+    free_[lines - 1] = new (p) FreeBlock{free_[lines - 1]};
+  }
+
+private:
+  static constexpr std::size_t line_size = 64;
+  static constexpr std::size_t max_lines = 64;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  InternodeArena() = default;
+
+  std::mutex mutex_;
+  std::atomic<bool> enabled_{false};
+  char *base_ = nullptr;
+  char *next_ = nullptr;
+  char *end_ = nullptr;
+  FreeBlock *free_[max_lines] = {};
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "inline_masstree_wrapper.hpp"
+
+// a byte string the tree does not own (when inserting) or owns (when read)
+struct ByteView {
+  const char *data = nullptr;
+  std::size_t size = 0;
+
+  bool operator==(const ByteView &other) const {
+    return size == other.size && memcmp(data, other.data, size) == 0;
+  }
+  bool operator!=(const ByteView &other) const { return !(*this == other); }
+};
+
+/**
+ * Copies each value into a cell carved from the inserting thread's threadinfo
+ * pools, which are per-thread free lists in cache-line size classes, so an
+ * insert costs no malloc and the caller need not keep the value alive.
+ * Replaced and removed cells go back through RCU. Cells larger than the
+ * biggest size class fall back to threadinfo::allocate.
+ *
+ * A ByteView returned by get_value() or handed to a scan visitor points into
+ * the cell and stays valid until the thread's next call into the wrapper.
+ */
+struct OwnedBytesCodec {
+  struct Slot;
+  using value_type = ByteView;
+
+  static constexpr std::size_t header_size = sizeof(uint64_t);
+  static constexpr std::size_t max_pooled_size =
+      threadinfo::pool_max_nlines * CACHE_LINE_SIZE;
+
+  static Slot *encode(const ByteView &value, reclaim_threadinfo &ti) {
+    std::size_t sz = cell_size(value.size);
+    char *cell = static_cast<char *>(sz <= max_pooled_size
+                                         ? ti.pool_allocate(sz, memtag_value)
+                                         : ti.allocate(sz, memtag_value));
+    uint64_t size = value.size;
+    memcpy(cell, &size, header_size);
+    memcpy(cell + header_size, value.data, value.size);
+    return reinterpret_cast<Slot *>(cell);
+  }
+
+  static ByteView decode(const Slot *slot) {
+    const char *cell = reinterpret_cast<const char *>(slot);
+    uint64_t size;
+    memcpy(&size, cell, header_size);
+    return ByteView{cell + header_size, static_cast<std::size_t>(size)};
+  }
+
+  static void discard(Slot *slot, reclaim_threadinfo &ti) {
+    std::size_t sz = cell_size(decode(slot).size);
+    if (sz <= max_pooled_size)
+      ti.pool_deallocate(slot, sz, memtag_value);
+    else
+      ti.deallocate(slot, sz, memtag_value);
+  }
+
+  static void retire(Slot *slot, reclaim_threadinfo &ti) {
+    std::size_t sz = cell_size(decode(slot).size);
+    if (sz <= max_pooled_size)
+      ti.pool_deallocate_rcu(slot, sz, memtag_value);
+    else
+      ti.deallocate_rcu(slot, sz, memtag_value);
+  }
+
+private:
+  static std::size_t cell_size(std::size_t size) { return header_size + size; }
+};
+
+using OwningMasstreeWrapper = EncodedMasstreeWrapper<OwnedBytesCodec>;
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * Hardware counters for benchmark phases, read in-process through
+ * perf_event_open(2). Benchmarks count each thread's share of a phase and
+ * print the counts per operation, so a throughput plateau can be told apart
+ * into cache misses, TLB misses or plain instruction count.
+ *
+ * Off unless PERF_COUNTERS=1 is set in the environment. Only user-space
+ * events of the calling thread are counted, which perf_event_paranoid <= 2
+ * allows; where an event cannot be opened (a VM without a PMU, a stricter
+ * paranoid setting, seccomp) the phase prints why instead of its counts.
+ */
+
+enum class PerfEvent {
+  cycles,
+  instructions,
+  llc_misses,
+  dtlb_misses,
+  branch_misses
+};
+constexpr std::size_t num_perf_events = 5;
+
+// one thread's counts over a phase; -1 where the event was not counted
+struct PerfSample {
+  std::array<int64_t, num_perf_events> counts;
+  uint64_t ops = 0;
+
+  PerfSample() { counts.fill(-1); }
+
+  int64_t operator[](PerfEvent e) const {
+    return counts[static_cast<std::size_t>(e)];
+  }
+
+  void merge(const PerfSample &other) {
+    for (std::size_t i = 0; i < num_perf_events; ++i)
+      if (other.counts[i] >= 0)
+        counts[i] = std::max<int64_t>(counts[i], 0) + other.counts[i];
+    ops += other.ops;
+  }
+};
+
+class PerfCounters {
+public:
+  static bool enabled() {
+    static const bool on = [] {
+      const char *env = getenv("PERF_COUNTERS");
+      return env != nullptr && strcmp(env, "0") != 0 && *env != '\0';
+    }();
+    return on;
+  }
+
+  /**
+   * Opens the events for the calling thread; with inherit, threads it
+   * creates afterwards count too, once they have exited.
+   */
+  explicit PerfCounters(bool inherit = false) {
+    fds_.fill(-1);
+    if (!enabled())
+      return;
+    for (std::size_t i = 0; i < num_perf_events; ++i) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.inherit = inherit;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds_[i] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+      if (fds_[i] < 0)
+        note_failure(names[i], errno);
+    }
+  }
+
+  ~PerfCounters() {
+    for (int fd : fds_)
+      if (fd >= 0)
+        close(fd);
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  void start() {
+    for (int fd : fds_)
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+  }
+
+  // counts since start(), scaled up where the kernel multiplexed an event
+  PerfSample stop(uint64_t ops) {
+    PerfSample s;
+    s.ops = ops;
+    for (std::size_t i = 0; i < num_perf_events; ++i) {
+      if (fds_[i] < 0)
+        continue;
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t v[3]; // value, time enabled, time running
+      if (read(fds_[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+        continue;
+      s.counts[i] = static_cast<int64_t>(
+          v[2] < v[1] ? static_cast<double>(v[0]) * v[1] / v[2] : v[0]);
+    }
+    return s;
+  }
+
+  static const char *name(std::size_t event) { return names[event]; }
+
+  // why events could not be opened, if any could not
+  static std::string failures() {
+    std::lock_guard<std::mutex> lk(failure_mutex());
+    return failure_text();
+  }
+
+private:
+  static constexpr uint32_t types[num_perf_events] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+  static constexpr uint64_t configs[num_perf_events] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_BRANCH_MISSES};
+  static constexpr const char *names[num_perf_events] = {
+      "cycles", "instructions", "LLC-misses", "dTLB-misses", "branch-misses"};
+
+  // the first error per event is kept; threads tend to repeat it
+  static void note_failure(const char *event, int err) {
+    std::lock_guard<std::mutex> lk(failure_mutex());
+    std::string &text = failure_text();
+    if (text.find(event) != std::string::npos)
+      return;
+    if (!text.empty())
+      text += "; ";
+    text += std::string(event) + ": " + strerror(err);
+  }
+
+  static std::mutex &failure_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  static std::string &failure_text() {
+    static std::string text;
+    return text;
+  }
+
+  std::array<int, num_perf_events> fds_;
+};
+
+/**
+ * The samples of one measured phase. Each thread adds its own; print()
+ * shows every thread and the sum, per operation.
+ */
+class PerfPhase {
+public:
+  explicit PerfPhase(std::string name) : name_(std::move(name)) {}
+
+  void add(std::size_t thread_id, const PerfSample &s) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    samples_[thread_id].merge(s);
+  }
+
+  void print(FILE *out) const {
+    if (!PerfCounters::enabled())
+      return;
+    std::lock_guard<std::mutex> lk(mutex_);
+    std::string failures = PerfCounters::failures();
+    PerfSample total;
+    for (const auto &ts : samples_)
+      total.merge(ts.second);
+    bool counted = false;
+    for (int64_t c : total.counts)
+      counted |= c >= 0;
+    if (!counted) {
+      fprintf(out,
+              "%s: hardware counters unavailable (%s); check "
+              "/proc/sys/kernel/perf_event_paranoid or run on bare metal\n",
+              name_.c_str(),
+              failures.empty() ? "no samples" : failures.c_str());
+      return;
+    }
+    fprintf(out, "%s, per op:\n%-12s %12s", name_.c_str(), "", "ops");
+    for (std::size_t e = 0; e < num_perf_events; ++e)
+      fprintf(out, " %13s", PerfCounters::name(e));
+    fprintf(out, " %6s\n", "IPC");
+    for (const auto &ts : samples_)
+      row(out, "thread " + std::to_string(ts.first), ts.second);
+    row(out, "total", total);
+    if (!failures.empty())
+      fprintf(out, "not counted: %s\n", failures.c_str());
+  }
+
+private:
+  void row(FILE *out, const std::string &title, const PerfSample &s) const {
+    fprintf(out, "%-12s %12" PRIu64, title.c_str(), s.ops);
+    for (int64_t c : s.counts) {
+      if (c < 0)
+        fprintf(out, " %13s", "-");
+      else
+        fprintf(out, " %13.2f", s.ops ? double(c) / s.ops : double(c));
+    }
+    int64_t cycles = s[PerfEvent::cycles];
+    int64_t instructions = s[PerfEvent::instructions];
+    if (cycles > 0 && instructions >= 0)
+      fprintf(out, " %6.2f\n", double(instructions) / cycles);
+    else
+      fprintf(out, " %6s\n", "-");
+  }
+
+  std::string name_;
+  mutable std::mutex mutex_;
+  std::map<std::size_t, PerfSample> samples_;
+};
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "masstree_wrapper.hpp"
+
+/**
+ * Snapshots of a MasstreeWrapper<T> in a local file, and reloading them.
+ *
+ * The file holds every key in sorted order, cut into checksummed blocks:
+ *   SnapshotHeader
+ *   block*:  SnapshotBlock, then records of
+ *            uint32 key length, uint32 value length, key, value
+ *   SnapshotBlockIndex per block
+ *   SnapshotTrailer
+ * Integers are in host byte order. A value length of snapshot_null_value
+ * stands for a nullptr value.
+ *
+ * Values go through a serializer, since T is the caller's type:
+ *   std::size_t size(const T &value);
+ *   void write(const T &value, char *out);
+ *   T *read(const char *in, std::size_t size);
+ *   void release(T *value);                     // undoes read()
+ * MasstreeWrapper never frees values, so the ones read() makes for a load
+ * belong to the caller, to release once they leave the tree; a failed load
+ * releases them itself.
+ */
+
+// T stored bit for bit
+template <typename T> struct TrivialSerializer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "TrivialSerializer needs a trivially copyable type");
+
+  std::size_t size(const T &) const { return sizeof(T); }
+  void write(const T &value, char *out) const {
+    memcpy(out, &value, sizeof(T));
+  }
+  T *read(const char *in, std::size_t size) const {
+    if (size != sizeof(T))
+      return nullptr;
+    T *value = new T;
+    memcpy(value, in, sizeof(T));
+    return value;
+  }
+  void release(T *value) const { delete value; }
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct SnapshotBlock {
+  uint32_t records;
+  uint32_t bytes; // of records following this header
+  uint64_t checksum;
+};
+
+struct SnapshotBlockIndex {
+  uint64_t offset;
+  uint64_t first_record;
+};
+
+struct SnapshotTrailer {
+  uint64_t index_offset;
+  uint64_t blocks;
+  uint64_t records;
+  uint64_t index_checksum;
+  char magic[8];
+};
+
+constexpr char snapshot_magic[8] = {'M', 'T', 'S', 'N', 'A', 'P', 0, 1};
+constexpr uint32_t snapshot_version = 1;
+constexpr uint32_t snapshot_null_value = UINT32_MAX;
+
+// result of a save or load; error is empty on success
+struct SnapshotInfo {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  std::string error;
+
+  explicit operator bool() const { return error.empty(); }
+};
+
+// word-at-a-time 64-bit hash; catches torn and corrupted blocks
+inline uint64_t snapshot_checksum(const char *data, std::size_t len) {
+  uint64_t h = UINT64_C(0x9e3779b97f4a7c15) ^ len;
+  std::size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = (h ^ w) * UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 32;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, len - i);
+  h = (h ^ tail) * UINT64_C(0xc4ceb9fe1a85ec53);
+  return h ^ (h >> 29);
+}
+
+/**
+ * Streams the table to path (through path.tmp, renamed once synced). The
+ * table is read in chunks of scan_chunk rows, each one a separate scan
+ * resuming after the last key, so concurrent writers are not blocked and
+ * reclamation keeps going: the image is consistent per chunk, not as a
+ * whole.
+ */
+template <typename T, int LW, int IW, typename Serializer>
+SnapshotInfo save_snapshot(MasstreeWrapper<T, LW, IW> &mt,
+                           const std::string &path, Serializer &&ser,
+                           std::size_t block_bytes = 1 << 20,
+                           int64_t scan_chunk = 4096) {
+  using Str = typename MasstreeWrapper<T, LW, IW>::Str;
+
+  struct Output {
+    FILE *f = nullptr;
+    std::size_t block_bytes = 0;
+    std::vector<char> block;
+    uint32_t block_records = 0;
+    std::vector<SnapshotBlockIndex> index;
+    uint64_t offset = 0;
+    uint64_t records = 0;
+    bool ok = true;
+
+    void put(const void *p, std::size_t n) {
+      ok = ok && fwrite(p, 1, n, f) == n;
+      offset += n;
+    }
+
+    void flush_block() {
+      if (block_records == 0)
+        return;
+      index.push_back(SnapshotBlockIndex{offset, records - block_records});
+      SnapshotBlock bh{block_records, static_cast<uint32_t>(block.size()),
+                       snapshot_checksum(block.data(), block.size())};
+      put(&bh, sizeof(bh));
+      put(block.data(), block.size());
+      block.clear();
+      block_records = 0;
+    }
+  };
+
+  struct Writer {
+    Output &out;
+    Serializer &ser;
+    std::string &last_key;
+    int64_t rows = 0;
+
+    void per_kv(const Str &key, const T *val, bool &) {
+      uint32_t klen = key.len;
+      uint32_t vlen = val ? static_cast<uint32_t>(ser.size(*val))
+                          : snapshot_null_value;
+      std::size_t at = out.block.size();
+      out.block.resize(at + 8 + klen + (val ? vlen : 0));
+      memcpy(&out.block[at], &klen, 4);
+      memcpy(&out.block[at + 4], &vlen, 4);
+      memcpy(&out.block[at + 8], key.s, klen);
+      if (val)
+        ser.write(*val, &out.block[at + 8 + klen]);
+      last_key.assign(key.s, key.len);
+      ++out.records;
+      ++out.block_records;
+      ++rows;
+      if (out.block.size() >= out.block_bytes)
+        out.flush_block();
+    }
+  };
+
+  SnapshotInfo info;
+  std::string tmp = path + ".tmp";
+  Output out;
+  out.f = fopen(tmp.c_str(), "wb");
+  out.block_bytes = block_bytes;
+  if (out.f == nullptr) {
+    info.error = "cannot open " + tmp;
+    return info;
+  }
+
+  SnapshotHeader header{};
+  memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+  header.version = snapshot_version;
+  out.put(&header, sizeof(header));
+
+  std::string last_key;
+  for (bool first = true;; first = false) {
+    std::string from = last_key;
+    Writer w{out, ser, last_key};
+    mt.scan(first ? nullptr : from.data(), from.size(), !first, nullptr, 0,
+            false, w, scan_chunk);
+    if (w.rows < scan_chunk || !out.ok)
+      break;
+  }
+  out.flush_block();
+
+  SnapshotTrailer trailer{};
+  std::size_t index_bytes = out.index.size() * sizeof(SnapshotBlockIndex);
+  trailer.index_offset = out.offset;
+  trailer.blocks = out.index.size();
+  trailer.records = out.records;
+  trailer.index_checksum = snapshot_checksum(
+      reinterpret_cast<const char *>(out.index.data()), index_bytes);
+  memcpy(trailer.magic, snapshot_magic, sizeof(trailer.magic));
+  out.put(out.index.data(), index_bytes);
+  out.put(&trailer, sizeof(trailer));
+  info.records = out.records;
+  info.bytes = out.offset;
+
+  bool ok = out.ok && fflush(out.f) == 0 && fsync(fileno(out.f)) == 0;
+  ok = (fclose(out.f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    info.error = "cannot write " + path;
+  }
+  return info;
+}
+
+/**
+ * Rebuilds an empty table from a snapshot. The file is mapped, its blocks
+ * are verified and decoded by num_threads threads, and the sorted result is
+ * handed to bulk_load. Nothing is loaded if any block fails to verify, if
+ * the index does not lay the blocks end to end, or if the keys are not
+ * strictly increasing (bulk_load would drop duplicates with their values).
+ */
+template <typename T, int LW, int IW, typename Serializer>
+SnapshotInfo load_snapshot(MasstreeWrapper<T, LW, IW> &mt,
+                           const std::string &path, Serializer &&ser,
+                           std::size_t num_threads = 1) {
+  SnapshotInfo info;
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0)
+      close(fd);
+    info.error = "cannot open " + path;
+    return info;
+  }
+  std::size_t size = st.st_size;
+  info.bytes = size;
+  if (size < sizeof(SnapshotHeader) + sizeof(SnapshotTrailer)) {
+    close(fd);
+    info.error = "truncated snapshot";
+    return info;
+  }
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    info.error = "cannot map " + path;
+    return info;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  const char *base = static_cast<const char *>(map);
+  auto fail = [&](const char *why) {
+    munmap(map, size);
+    info.error = why;
+    return info;
+  };
+
+  SnapshotHeader header;
+  SnapshotTrailer trailer;
+  memcpy(&header, base, sizeof(header));
+  memcpy(&trailer, base + size - sizeof(trailer), sizeof(trailer));
+  if (memcmp(header.magic, snapshot_magic, 8) != 0 ||
+      memcmp(trailer.magic, snapshot_magic, 8) != 0 ||
+      header.version != snapshot_version)
+    return fail("not a snapshot");
+  // the index ends where the trailer starts; compared so that nothing read
+  // from the file can overflow
+  uint64_t index_end = size - sizeof(trailer);
+  if (trailer.blocks > index_end / sizeof(SnapshotBlockIndex))
+    return fail("corrupt block index");
+  uint64_t index_bytes = trailer.blocks * sizeof(SnapshotBlockIndex);
+  if (trailer.index_offset < sizeof(header) ||
+      trailer.index_offset > index_end - index_bytes ||
+      trailer.index_offset + index_bytes != index_end)
+    return fail("corrupt block index");
+  std::vector<SnapshotBlockIndex> index(trailer.blocks);
+  if (index_bytes != 0)
+    memcpy(index.data(), base + trailer.index_offset, index_bytes);
+  if (snapshot_checksum(reinterpret_cast<const char *>(index.data()),
+                        index_bytes) != trailer.index_checksum)
+    return fail("corrupt block index");
+  // blocks follow each other with no gap or overlap, in bytes and records
+  uint64_t offset = sizeof(SnapshotHeader);
+  uint64_t records = 0;
+  for (const SnapshotBlockIndex &bi : index) {
+    if (bi.offset != offset || bi.first_record != records ||
+        trailer.index_offset - offset < sizeof(SnapshotBlock))
+      return fail("corrupt block index");
+    SnapshotBlock bh;
+    memcpy(&bh, base + offset, sizeof(bh));
+    offset += sizeof(bh) + bh.bytes;
+    records += bh.records;
+    // every record takes at least its two lengths
+    if (offset > trailer.index_offset || bh.records > bh.bytes / 8)
+      return fail("corrupt block index");
+  }
+  if (offset != trailer.index_offset || records != trailer.records)
+    return fail("corrupt block index");
+
+  // blocks know where their records go, so threads fill entries in place
+  std::vector<std::pair<std::string_view, T *>> entries(trailer.records);
+  std::vector<const char *> errors(trailer.blocks, nullptr);
+  auto decode = [&](std::size_t b) -> const char * {
+    const SnapshotBlockIndex &bi = index[b];
+    SnapshotBlock bh;
+    memcpy(&bh, base + bi.offset, sizeof(bh));
+    const char *p = base + bi.offset + sizeof(bh);
+    const char *end = p + bh.bytes;
+    if (snapshot_checksum(p, bh.bytes) != bh.checksum)
+      return "block checksum mismatch";
+    for (uint32_t r = 0; r < bh.records; ++r) {
+      uint32_t klen, vlen;
+      if (end - p < 8)
+        return "corrupt record";
+      memcpy(&klen, p, 4);
+      memcpy(&vlen, p + 4, 4);
+      std::size_t stored = (vlen == snapshot_null_value ? 0 : vlen);
+      if (static_cast<std::size_t>(end - p - 8) < klen + stored)
+        return "corrupt record";
+      T *value = nullptr;
+      if (vlen != snapshot_null_value &&
+          (value = ser.read(p + 8 + klen, vlen)) == nullptr)
+        return "value does not deserialize";
+      std::string_view key(p + 8, klen);
+      entries[bi.first_record + r] = {key, value};
+      p += 8 + klen + stored;
+      if (r != 0 && !(entries[bi.first_record + r - 1].first < key))
+        return "keys out of order";
+    }
+    return nullptr;
+  };
+
+  std::size_t workers =
+      std::max<std::size_t>(1, std::min<std::size_t>(num_threads,
+                                                     trailer.blocks));
+  std::vector<std::thread> threads;
+  for (std::size_t w = 0; w < workers; ++w)
+    threads.emplace_back([&, w] {
+      for (std::size_t b = w; b < trailer.blocks; b += workers)
+        errors[b] = decode(b);
+    });
+  for (auto &t : threads)
+    t.join();
+
+  const char *error = nullptr;
+  for (const char *e : errors)
+    error = error ? error : e;
+  for (std::size_t b = 1; error == nullptr && b < trailer.blocks; ++b) {
+    std::size_t first = index[b].first_record;
+    if (first != 0 && first < entries.size() &&
+        !(entries[first - 1].first < entries[first].first))
+      error = "keys out of order";
+  }
+  std::size_t loaded = 0;
+  if (error == nullptr && trailer.records != 0) {
+    loaded = mt.bulk_load(entries.begin(), entries.end(), 1.0, num_threads);
+    if (loaded == 0)
+      error = "table is not empty";
+  }
+  if (error != nullptr) {
+    for (auto &e : entries)
+      if (e.second)
+        ser.release(e.second);
+    return fail(error);
+  }
+  // keys were copied into the tree; only the values outlive the mapping
+  munmap(map, size);
+  info.records = loaded;
+  return info;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "epoch_reclaimer.hpp"
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Shape and footprint of one tree, as MasstreeWrapper::stats() finds it.
+ * Keys longer than 8 bytes that share their first 8 bytes live in a layer
+ * (a tree of its own) below the slot for those bytes; layers[d] sums all
+ * layers d levels down, layers[0] being the top tree. Node counts come from
+ * the walk over this tree; memory comes from the allocator counters and
+ * covers every tree in the process. It is what the trees have in use:
+ * free lines that thread pools keep for reuse are not included, and the
+ * report says so.
+ */
+struct TreeStats {
+  struct Layer {
+    uint64_t trees = 0;        // layer roots at this depth; 1 for the top
+    uint64_t keys = 0;         // keys that end at this depth
+    uint64_t layer_slots = 0;  // slots that lead one layer down
+    uint64_t suffix_keys = 0;  // keys with bytes past their slice
+    uint64_t suffix_bytes = 0; // of those bytes
+    uint64_t leaves = 0;
+    uint64_t internodes = 0;
+    std::vector<uint64_t> levels; // nodes by height: leaves, parents, ...
+  };
+
+  int leaf_width = 0;
+  int internode_width = 0;
+  std::size_t leaf_size = 0; // bytes per node, in whole cache lines
+  std::size_t internode_size = 0;
+  std::vector<Layer> layers;
+  std::vector<uint64_t> leaf_fill;      // leaves by slots in use
+  std::vector<uint64_t> internode_fill; // internodes by children
+  PoolAccounting::Usage memory;
+  uint64_t rcu_pending_bytes = 0; // retired, not yet freed
+  uint64_t walk_ns = 0;
+
+  uint64_t keys() const { return sum(&Layer::keys); }
+  uint64_t leaves() const { return sum(&Layer::leaves); }
+  uint64_t internodes() const { return sum(&Layer::internodes); }
+  uint64_t suffix_bytes() const { return sum(&Layer::suffix_bytes); }
+  std::size_t depth() const { return layers.size(); }
+  std::size_t height() const {
+    return layers.empty() ? 0 : layers[0].levels.size();
+  }
+
+  // slots in use over slots in all leaves
+  double leaf_fill_factor() const {
+    uint64_t used = 0;
+    for (std::size_t i = 0; i < leaf_fill.size(); ++i)
+      used += i * leaf_fill[i];
+    return leaves() ? double(used) / (leaves() * leaf_width) : 0;
+  }
+
+  // nodes and key suffixes of this tree; values are not included
+  uint64_t node_bytes() const {
+    return leaves() * leaf_size + internodes() * internode_size +
+           suffix_bytes();
+  }
+
+  double bytes_per_key() const {
+    return keys() ? double(node_bytes()) / keys() : 0;
+  }
+
+  void dump(FILE *out) const {
+    fprintf(out,
+            "tree: %" PRIu64 " keys, %zu layer levels, height %zu, %" PRIu64
+            " leaves, %" PRIu64 " internodes, %.1f%% leaf fill, "
+            "%.1f bytes/key, walked in %.2f ms\n",
+            keys(), depth(), height(), leaves(), internodes(),
+            100 * leaf_fill_factor(), bytes_per_key(), walk_ns / 1e6);
+    for (std::size_t d = 0; d < layers.size(); ++d) {
+      const Layer &l = layers[d];
+      fprintf(out,
+              "layer %zu: %" PRIu64 " trees, %" PRIu64 " keys, %" PRIu64
+              " layer slots, %" PRIu64 " suffixes (%" PRIu64 " bytes), "
+              "nodes by height:",
+              d, l.trees, l.keys, l.layer_slots, l.suffix_keys,
+              l.suffix_bytes);
+      for (uint64_t n : l.levels)
+        fprintf(out, " %" PRIu64, n);
+      fprintf(out, "\n");
+    }
+    fprintf(out, "leaf fill:");
+    for (uint64_t n : leaf_fill)
+      fprintf(out, " %" PRIu64, n);
+    fprintf(out, "\ninternode fill:");
+    for (uint64_t n : internode_fill)
+      fprintf(out, " %" PRIu64, n);
+    fprintf(out, "\nin use (all trees, pooled free lines excluded):");
+    for (int k = 0; k < PoolAccounting::num_kinds; ++k)
+      fprintf(out, " %s %.1f MB", PoolAccounting::name(k),
+              memory.bytes[k] / 1e6);
+    fprintf(out, ", RCU pending %.1f MB\n", rcu_pending_bytes / 1e6);
+  }
+
+  void dump_json(FILE *out) const {
+    auto array = [out](const std::vector<uint64_t> &v) {
+      fprintf(out, "[");
+      for (std::size_t i = 0; i < v.size(); ++i)
+        fprintf(out, "%s%" PRIu64, i ? "," : "", v[i]);
+      fprintf(out, "]");
+    };
+    fprintf(out,
+            "{\"keys\":%" PRIu64 ",\"depth\":%zu,\"height\":%zu,"
+            "\"leaves\":%" PRIu64 ",\"internodes\":%" PRIu64
+            ",\"leaf_width\":%d,\"internode_width\":%d,"
+            "\"leaf_fill_factor\":%.4f,\"node_bytes\":%" PRIu64
+            ",\"bytes_per_key\":%.2f,\"walk_ns\":%" PRIu64 ",\"layers\":[",
+            keys(), depth(), height(), leaves(), internodes(), leaf_width,
+            internode_width, leaf_fill_factor(), node_bytes(),
+            bytes_per_key(), walk_ns);
+    for (std::size_t d = 0; d < layers.size(); ++d) {
+      const Layer &l = layers[d];
+      fprintf(out,
+              "%s{\"trees\":%" PRIu64 ",\"keys\":%" PRIu64
+              ",\"layer_slots\":%" PRIu64 ",\"suffix_keys\":%" PRIu64
+              ",\"suffix_bytes\":%" PRIu64 ",\"leaves\":%" PRIu64
+              ",\"internodes\":%" PRIu64 ",\"levels\":",
+              d ? "," : "", l.trees, l.keys, l.layer_slots, l.suffix_keys,
+              l.suffix_bytes, l.leaves, l.internodes);
+      array(l.levels);
+      fprintf(out, "}");
+    }
+    fprintf(out, "],\"leaf_fill\":");
+    array(leaf_fill);
+    fprintf(out, ",\"internode_fill\":");
+    array(internode_fill);
+    fprintf(out, ",\"memory\":{");
+    for (int k = 0; k < PoolAccounting::num_kinds; ++k)
+      fprintf(out,
+              "\"%s\":{\"bytes\":%" PRId64 ",\"allocations\":%" PRIu64
+              "},",
+              PoolAccounting::name(k), memory.bytes[k],
+              memory.allocations[k]);
+    fprintf(out,
+            "\"rcu_pending_bytes\":%" PRIu64
+            ",\"includes_pooled_free_lines\":false}}\n",
+            rcu_pending_bytes);
+  }
+
+private:
+  uint64_t sum(uint64_t Layer::*field) const {
+    uint64_t total = 0;
+    for (const Layer &l : layers)
+      total += l.*field;
+    return total;
+  }
+};
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <unistd.h>
+
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <functional>
 #include <stdexcept>
 #include <utility>
 
@@ -95,6 +100,51 @@ private:
     std::vector<size_t> perm;
 };
 
+/**
+ * Resident set size of this process in bytes (0 if /proc is unavailable).
+ */
+inline std::size_t rss_bytes() {
+    long pages = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr) return 0;
+    if (fscanf(f, "%*s %ld", &pages) != 1) pages = 0;
+    fclose(f);
+    return static_cast<std::size_t>(pages) * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Runs f once, prints its wall time and ops per second in millions, and
+ * returns the rate. unit names what ops counts, e.g. "rows".
+ */
+inline double measure_mops(const char* title, uint64_t ops,
+                           const std::function<void()>& f,
+                           const char* unit = "ops") {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double sec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    double mops = ops / sec / 1e6;
+    printf("%-24s %8.1f ms %8.2f M%s/s\n", title, sec * 1e3, mops, unit);
+    return mops;
+}
+
+/**
+ * Scan visitor for benchmarks: counts the rows and sums their values, so
+ * two ways of scanning the same range can be checked against each other.
+ * Takes any key type, so it fits the typed wrappers' scans too.
+ */
+struct CountVisitor {
+    uint64_t rows = 0;
+    uint64_t sum = 0;
+
+    template <typename Key, typename Value>
+    void per_kv(const Key&, const Value* val, bool&) {
+        ++rows;
+        sum += static_cast<uint64_t>(*val);
+    }
+};
+
 template <std::size_t N>
 struct num {
     static const constexpr auto value = N;
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads that run one job at a time, each worker calling
+ * job(worker_index). Workers are long-lived so that per-thread state such as
+ * a masstree threadinfo is set up once (by thread_start) and reused by every
+ * job instead of being made again for each one.
+ */
+class WorkerPool {
+public:
+  WorkerPool(std::size_t num_workers,
+             std::function<void(std::size_t)> thread_start = nullptr) {
+    for (std::size_t w = 0; w < num_workers; ++w)
+      threads_.emplace_back([this, w, thread_start] {
+        if (thread_start)
+          thread_start(w);
+        run(w);
+      });
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto &t : threads_)
+      t.join();
+  }
+
+  std::size_t size() const { return threads_.size(); }
+
+  // starts job on every worker; the previous job must have been waited for
+  void start(std::function<void(std::size_t)> job) {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      job_ = std::move(job);
+      running_ = threads_.size();
+      ++generation_;
+    }
+    start_cv_.notify_all();
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    done_cv_.wait(lk, [this] { return running_ == 0; });
+    job_ = nullptr;
+  }
+
+  void run_all(std::function<void(std::size_t)> job) {
+    start(std::move(job));
+    wait();
+  }
+
+private:
+  void run(std::size_t w) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lk(mutex_);
+    for (;;) {
+      start_cv_.wait(lk, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_)
+        return;
+      seen = generation_;
+      lk.unlock();
+      job_(w);
+      lk.lock();
+      if (--running_ == 0)
+        done_cv_.notify_all();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  std::function<void(std::size_t)> job_;
+  std::size_t running_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
@@ -0,0 +1,791 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_histogram.hpp"
+#include "masstree_wrapper.hpp"
+#include "snapshot.hpp"
+
+/**
+ * Redo log of a table's writes, made durable by group commit.
+ *
+ * Writers append records to a buffer of their own. A commit thread wakes
+ * every commit_interval (or sooner when a buffer passes flush_bytes), takes
+ * every buffer, writes them as checksummed frames to the current segment
+ * file and fdatasyncs it once for the whole batch. Synchronous writers then
+ * return; asynchronous ones have already returned and may lose the last
+ * commit_interval of writes in a crash.
+ *
+ * Segments are dir/wal-NNNNNN.log. A log opened on an existing directory
+ * starts a new segment; replay() reads the older ones, stopping at the first
+ * torn or corrupt frame of each. Records hold the state a write left behind
+ * (key = value, or key removed) and a log sequence number, so replay keeps
+ * the last record of every key and the order of keys does not matter.
+ * Sequence numbers start at the new segment's index times 2^40, above any
+ * an earlier open of the directory can have used, so a log written without
+ * replaying first never collides with older segments.
+ *
+ * cut() starts a new segment and truncate() deletes the ones before it, so
+ * that once a snapshot holds every write applied before the cut, replay
+ * only reads what came after.
+ *
+ * An I/O error while committing aborts the process: after a failed fsync
+ * the state of the file is unknown and retrying is not safe. Errors while
+ * replaying are returned instead, as load_snapshot returns them.
+ */
+struct WalOptions {
+  std::string dir = "wal";
+  std::chrono::microseconds commit_interval{1000};
+  std::size_t flush_bytes = 1 << 20;    // per thread, commits early when full
+  std::size_t segment_bytes = 64 << 20; // starts a new segment past this
+  bool synchronous = true;              // writes wait for their commit
+};
+
+// result of a replay; error is empty on success
+struct WalReplayInfo {
+  uint64_t keys = 0;    // applied
+  uint64_t records = 0; // read, superseded ones included
+  uint64_t bytes = 0;
+  std::string error;
+
+  explicit operator bool() const { return error.empty(); }
+};
+
+class WriteAheadLog {
+public:
+  struct Stats {
+    uint64_t batches = 0;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    LatencyHistogram batch_records; // records per commit
+    LatencyHistogram sync_ns;       // write + fdatasync per commit
+    LatencyHistogram commit_ns;     // append to durable, synchronous writers
+
+    void dump(FILE *out) const {
+      fprintf(out,
+              "wal: %" PRIu64 " commits, %" PRIu64 " records, %.1f MB\n",
+              batches, records, bytes / 1e6);
+      auto row = [out](const char *name, const LatencyHistogram &h) {
+        if (h.count() == 0)
+          return;
+        fprintf(out,
+                "%-16s p50 %10" PRIu64 " p99 %10" PRIu64 " max %10" PRIu64
+                "\n",
+                name, h.percentile(0.5), h.percentile(0.99), h.max());
+      };
+      row("batch records", batch_records);
+      row("sync (ns)", sync_ns);
+      row("commit (ns)", commit_ns);
+    }
+  };
+
+  // marks an appended record; wait() returns once it is durable
+  struct Ticket {
+    uint64_t batch = 0;
+    uint64_t start_ns = 0;
+  };
+
+  static constexpr uint32_t removed = UINT32_MAX; // value length of a remove
+
+  explicit WriteAheadLog(WalOptions options)
+      : options_(std::move(options)), id_(next_log_id()) {
+    std::error_code ec;
+    std::filesystem::create_directories(options_.dir, ec);
+    if (ec)
+      throw std::runtime_error("cannot create " + options_.dir);
+    for (const auto &entry :
+         std::filesystem::directory_iterator(options_.dir)) {
+      unsigned index;
+      if (sscanf(entry.path().filename().c_str(), "wal-%u.log", &index) == 1)
+        old_segments_.push_back(index);
+    }
+    std::sort(old_segments_.begin(), old_segments_.end());
+    segment_ = old_segments_.empty() ? 1 : old_segments_.back() + 1;
+    next_lsn_ = static_cast<uint64_t>(segment_) << lsn_segment_shift;
+    open_segment();
+    thread_ = std::thread([this] { run(); });
+  }
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  ~WriteAheadLog() {
+    {
+      std::lock_guard<std::mutex> lk(wake_mutex_);
+      stopping_ = true;
+    }
+    wake_cv_.notify_all();
+    thread_.join();
+    close(fd_);
+  }
+
+  const WalOptions &options() const { return options_; }
+
+  /**
+   * Appends a record for key (value nullptr: key removed). Callers must hold
+   * whatever orders writes to the same key, so that sequence numbers follow
+   * the order the writes were applied in.
+   */
+  Ticket append(const char *key, std::size_t len_key, const char *value,
+                std::size_t len_value) {
+    ThreadLog &log = local();
+    Ticket ticket;
+    ticket.start_ns = options_.synchronous ? now_ns() : 0;
+    bool full;
+    {
+      std::lock_guard<std::mutex> lk(log.mutex);
+      // taken under the buffer lock: a commit that opens a later batch
+      // cannot have taken this buffer yet
+      ticket.batch = open_batch_.load(std::memory_order_acquire);
+      RecordHeader h{next_lsn_.fetch_add(1, std::memory_order_relaxed),
+                     static_cast<uint32_t>(len_key),
+                     value ? static_cast<uint32_t>(len_value) : removed};
+      std::size_t at = log.buffer.size();
+      log.buffer.resize(at + sizeof(h) + len_key + (value ? len_value : 0));
+      memcpy(&log.buffer[at], &h, sizeof(h));
+      memcpy(&log.buffer[at + sizeof(h)], key, len_key);
+      if (value)
+        memcpy(&log.buffer[at + sizeof(h) + len_key], value, len_value);
+      ++log.records;
+      full = log.buffer.size() >= options_.flush_bytes;
+    }
+    if (full) {
+      std::lock_guard<std::mutex> lk(wake_mutex_);
+      commit_requested_ = true;
+      wake_cv_.notify_one();
+    }
+    return ticket;
+  }
+
+  // blocks until the ticket's batch is durable (no-op unless synchronous)
+  void wait(const Ticket &ticket) {
+    if (!options_.synchronous)
+      return;
+    {
+      std::unique_lock<std::mutex> lk(durable_mutex_);
+      durable_cv_.wait(lk, [&] { return durable_batch_ >= ticket.batch; });
+    }
+    local().commit_ns.record(now_ns() - ticket.start_ns);
+  }
+
+  // commits everything appended so far, on the calling thread
+  void flush() { commit(); }
+
+  /**
+   * Commits what is buffered and starts a new segment, returning its index.
+   * The records in earlier segments were appended, after their writes were
+   * applied to the table, before cut() returned, so a snapshot started
+   * afterwards holds those writes or newer ones, and together with the
+   * segments from the returned one on it covers the whole log.
+   */
+  unsigned cut() {
+    commit();
+    std::lock_guard<std::mutex> lk(commit_mutex_);
+    close(fd_);
+    ++segment_;
+    open_segment();
+    return segment_;
+  }
+
+  /**
+   * Deletes the segments before segment (see cut()); replay() no longer
+   * reads them. Call it only once whatever replaces them, e.g. a snapshot,
+   * is durable.
+   */
+  void truncate(unsigned segment) {
+    std::lock_guard<std::mutex> lk(commit_mutex_);
+    for (const auto &entry :
+         std::filesystem::directory_iterator(options_.dir)) {
+      unsigned index;
+      if (sscanf(entry.path().filename().c_str(), "wal-%u.log", &index) ==
+              1 &&
+          index < segment && unlink(entry.path().c_str()) != 0)
+        fail("cannot delete", entry.path().string());
+    }
+    old_segments_.erase(std::remove_if(old_segments_.begin(),
+                                       old_segments_.end(),
+                                       [segment](unsigned index) {
+                                         return index < segment;
+                                       }),
+                        old_segments_.end());
+    sync_dir();
+  }
+
+  /**
+   * Reads the segments that existed when the log was opened and calls
+   * apply(key, value, len_value) with the last record of every key (value
+   * nullptr when that record is a remove) in num_threads ranges of keys.
+   * apply returns nullptr, or an error that stops its range. The ranges run
+   * on threads of their own, or through run_jobs(n, job), which must call
+   * job(0) ... job(n - 1) and return when they are done. Later appends get
+   * sequence numbers above every replayed one. Like load_snapshot, failures
+   * are reported in the result (the table may then be partly replayed).
+   */
+  WalReplayInfo replay(
+      std::size_t num_threads,
+      const std::function<const char *(std::string_view, const char *,
+                                       std::size_t)> &apply,
+      const std::function<void(std::size_t,
+                               const std::function<void(std::size_t)> &)>
+          &run_jobs = nullptr) {
+    WalReplayInfo info;
+    std::vector<Mapping> maps;
+    std::vector<Record> records;
+    for (unsigned index : old_segments_)
+      if (!read_segment(index, maps, records, info.bytes)) {
+        info.error = "cannot read " + segment_path(index);
+        break;
+      }
+    info.records = records.size();
+
+    uint64_t max_lsn = 0;
+    for (const Record &r : records)
+      max_lsn = std::max(max_lsn, r.lsn);
+    uint64_t next = next_lsn_.load();
+    while (next <= max_lsn &&
+           !next_lsn_.compare_exchange_weak(next, max_lsn + 1))
+      ;
+
+    // split the key space at quantiles of a sample, one range per thread
+    num_threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(num_threads, records.size() / 1024));
+    std::vector<std::string_view> sample;
+    std::size_t samples = 64 * num_threads;
+    for (std::size_t i = 0; num_threads > 1 && i < samples; ++i)
+      sample.push_back(records[records.size() * i / samples].key);
+    std::sort(sample.begin(), sample.end());
+    std::vector<std::string_view> splitters;
+    for (std::size_t t = 1; t < num_threads; ++t)
+      splitters.push_back(sample[sample.size() * t / num_threads]);
+    std::vector<std::vector<const Record *>> ranges(num_threads);
+    for (const Record &r : records)
+      ranges[std::upper_bound(splitters.begin(), splitters.end(), r.key) -
+             splitters.begin()]
+          .push_back(&r);
+
+    std::atomic<std::size_t> applied{0};
+    std::vector<const char *> errors(num_threads, nullptr);
+    auto replay_range = [&](std::size_t t) {
+      std::vector<const Record *> &range = ranges[t];
+      std::sort(range.begin(), range.end(),
+                [](const Record *a, const Record *b) {
+                  return a->key != b->key ? a->key < b->key : a->lsn < b->lsn;
+                });
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < range.size() && errors[t] == nullptr; ++i) {
+        if (i + 1 < range.size() && range[i + 1]->key == range[i]->key)
+          continue; // superseded
+        const Record &r = *range[i];
+        errors[t] = apply(r.key, r.len_value == removed ? nullptr : r.value,
+                          r.len_value == removed ? 0 : r.len_value);
+        n += errors[t] == nullptr;
+      }
+      applied += n;
+    };
+    if (!info.error.empty()) {
+      // nothing is applied from a log that could not be read whole
+    } else if (num_threads == 1) {
+      replay_range(0);
+    } else if (run_jobs) {
+      run_jobs(num_threads, replay_range);
+    } else {
+      std::vector<std::thread> threads;
+      for (std::size_t t = 1; t < num_threads; ++t)
+        threads.emplace_back([&, t] { replay_range(t); });
+      replay_range(0);
+      for (auto &t : threads)
+        t.join();
+    }
+
+    for (const Mapping &m : maps)
+      munmap(m.addr, m.size);
+    for (const char *e : errors)
+      if (e != nullptr && info.error.empty())
+        info.error = e;
+    info.keys = applied;
+    return info;
+  }
+
+  Stats stats() {
+    Stats s;
+    {
+      std::lock_guard<std::mutex> lk(commit_mutex_);
+      s.batches = batches_;
+      s.records = records_;
+      s.bytes = bytes_;
+      s.batch_records.merge(batch_records_);
+      s.sync_ns.merge(sync_ns_);
+    }
+    std::lock_guard<std::mutex> lk(logs_mutex_);
+    for (const auto &log : logs_)
+      s.commit_ns.merge(log->commit_ns);
+    return s;
+  }
+
+private:
+  struct RecordHeader {
+    uint64_t lsn;
+    uint32_t len_key;
+    uint32_t len_value;
+  };
+
+  // one thread's buffer within a commit
+  struct FrameHeader {
+    uint32_t magic;
+    uint32_t records;
+    uint64_t bytes;
+    uint64_t checksum;
+  };
+
+  static constexpr uint32_t frame_magic = 0x4d54574c; // "MTWL"
+  // sequence numbers of one open start at its first segment's index << this
+  static constexpr int lsn_segment_shift = 40;
+
+  struct alignas(64) ThreadLog {
+    std::mutex mutex;
+    std::vector<char> buffer;
+    uint32_t records = 0;
+    LatencyHistogram commit_ns; // written by the owning thread only
+  };
+
+  struct Record {
+    std::string_view key;
+    const char *value;
+    uint32_t len_value;
+    uint64_t lsn;
+  };
+
+  struct Mapping {
+    void *addr;
+    std::size_t size;
+  };
+
+  // covers the record count as well as the body (whose length it seeds)
+  static uint64_t frame_checksum(uint32_t records, const char *body,
+                                 uint64_t bytes) {
+    uint64_t words[2] = {records, snapshot_checksum(body, bytes)};
+    return snapshot_checksum(reinterpret_cast<const char *>(words),
+                             sizeof(words));
+  }
+
+  static uint64_t next_log_id() {
+    static std::atomic<uint64_t> id{0};
+    return ++id;
+  }
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // the calling thread's buffer; ids are never reused, so entries of logs
+  // that are gone are never looked up again
+  ThreadLog &local() {
+    thread_local std::unordered_map<uint64_t, ThreadLog *> logs;
+    ThreadLog *&log = logs[id_];
+    if (log == nullptr) {
+      std::lock_guard<std::mutex> lk(logs_mutex_);
+      logs_.emplace_back(new ThreadLog);
+      log = logs_.back().get();
+    }
+    return *log;
+  }
+
+  std::string segment_path(unsigned index) const {
+    char name[32];
+    snprintf(name, sizeof(name), "wal-%06u.log", index);
+    return options_.dir + "/" + name;
+  }
+
+  static void fail(const char *what, const std::string &path) {
+    fprintf(stderr, "write-ahead log: %s %s: %s\n", what, path.c_str(),
+            strerror(errno));
+    std::abort();
+  }
+
+  void open_segment() {
+    std::string path = segment_path(segment_);
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+      fail("cannot create", path);
+    // make the new file's directory entry durable too
+    sync_dir();
+    segment_written_ = 0;
+  }
+
+  void sync_dir() {
+    int dir = open(options_.dir.c_str(), O_RDONLY);
+    if (dir < 0 || fsync(dir) != 0)
+      fail("cannot sync", options_.dir);
+    close(dir);
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lk(wake_mutex_);
+    while (!stopping_) {
+      wake_cv_.wait_for(lk, options_.commit_interval,
+                        [this] { return stopping_ || commit_requested_; });
+      commit_requested_ = false;
+      lk.unlock();
+      commit();
+      lk.lock();
+    }
+    lk.unlock();
+    commit();
+  }
+
+  void commit() {
+    std::lock_guard<std::mutex> commit_lk(commit_mutex_);
+    uint64_t batch = open_batch_.fetch_add(1, std::memory_order_acq_rel);
+    std::vector<ThreadLog *> logs;
+    {
+      std::lock_guard<std::mutex> lk(logs_mutex_);
+      for (const auto &log : logs_)
+        logs.push_back(log.get());
+    }
+
+    batch_.clear();
+    uint64_t records = 0;
+    for (ThreadLog *log : logs) {
+      std::lock_guard<std::mutex> lk(log->mutex);
+      if (log->records == 0)
+        continue;
+      FrameHeader h{frame_magic, log->records, log->buffer.size(),
+                    frame_checksum(log->records, log->buffer.data(),
+                                   log->buffer.size())};
+      std::size_t at = batch_.size();
+      batch_.resize(at + sizeof(h) + log->buffer.size());
+      memcpy(&batch_[at], &h, sizeof(h));
+      memcpy(&batch_[at + sizeof(h)], log->buffer.data(), log->buffer.size());
+      records += log->records;
+      log->buffer.clear();
+      log->records = 0;
+    }
+
+    if (records != 0) {
+      uint64_t start = now_ns();
+      for (std::size_t done = 0; done < batch_.size();) {
+        ssize_t n = write(fd_, batch_.data() + done, batch_.size() - done);
+        if (n < 0) {
+          if (errno == EINTR)
+            continue;
+          fail("cannot write", segment_path(segment_));
+        }
+        done += n;
+      }
+      if (fdatasync(fd_) != 0)
+        fail("cannot sync", segment_path(segment_));
+      sync_ns_.record(now_ns() - start);
+      batch_records_.record(records);
+      ++batches_;
+      records_ += records;
+      bytes_ += batch_.size();
+      segment_written_ += batch_.size();
+      if (segment_written_ >= options_.segment_bytes) {
+        close(fd_);
+        ++segment_;
+        open_segment();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(durable_mutex_);
+      durable_batch_ = batch;
+    }
+    durable_cv_.notify_all();
+  }
+
+  /**
+   * Maps a segment and collects the records of its intact frames. False if
+   * the file cannot be read; a torn or corrupt frame only ends the segment.
+   */
+  bool read_segment(unsigned index, std::vector<Mapping> &maps,
+                    std::vector<Record> &records, uint64_t &bytes) const {
+    std::string path = segment_path(index);
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0)
+        close(fd);
+      return 0;
+    }
+    std::size_t size = st.st_size;
+    if (size == 0) {
+      close(fd);
+      return 1;
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+      return 0;
+    madvise(map, size, MADV_SEQUENTIAL);
+    maps.push_back(Mapping{map, size});
+    bytes += size;
+
+    const char *p = static_cast<const char *>(map);
+    const char *end = p + size;
+    while (static_cast<std::size_t>(end - p) >= sizeof(FrameHeader)) {
+      FrameHeader h;
+      memcpy(&h, p, sizeof(h));
+      const char *body = p + sizeof(h);
+      if (h.magic != frame_magic ||
+          h.bytes > static_cast<std::size_t>(end - body) ||
+          frame_checksum(h.records, body, h.bytes) != h.checksum)
+        return 1; // torn tail
+      // a frame that passes the checksum is still parsed defensively: its
+      // records must fill it exactly
+      const char *q = body;
+      const char *frame_end = body + h.bytes;
+      std::size_t first = records.size();
+      for (uint32_t r = 0; r < h.records; ++r) {
+        RecordHeader rh;
+        if (static_cast<std::size_t>(frame_end - q) < sizeof(rh))
+          break;
+        memcpy(&rh, q, sizeof(rh));
+        const char *key = q + sizeof(rh);
+        uint64_t stored = rh.len_value == removed ? 0 : rh.len_value;
+        if (static_cast<uint64_t>(frame_end - key) < rh.len_key + stored)
+          break;
+        records.push_back(Record{std::string_view(key, rh.len_key),
+                                 key + rh.len_key, rh.len_value, rh.lsn});
+        q = key + rh.len_key + stored;
+      }
+      if (q != frame_end || records.size() - first != h.records) {
+        records.resize(first);
+        return 1; // corrupt frame: nothing from here on is trusted
+      }
+      p = frame_end;
+    }
+    return 1;
+  }
+
+  const WalOptions options_;
+  const uint64_t id_;
+
+  std::atomic<uint64_t> next_lsn_{0};
+  // batch that appends join; commit() takes it and opens the next
+  std::atomic<uint64_t> open_batch_{1};
+
+  std::mutex logs_mutex_;
+  std::vector<std::unique_ptr<ThreadLog>> logs_;
+
+  std::mutex commit_mutex_; // one commit at a time; guards what follows
+  std::vector<char> batch_;
+  std::vector<unsigned> old_segments_;
+  unsigned segment_ = 0;
+  int fd_ = -1;
+  uint64_t segment_written_ = 0;
+  uint64_t batches_ = 0;
+  uint64_t records_ = 0;
+  uint64_t bytes_ = 0;
+  LatencyHistogram batch_records_;
+  LatencyHistogram sync_ns_;
+
+  std::mutex durable_mutex_;
+  std::condition_variable durable_cv_;
+  uint64_t durable_batch_ = 0;
+
+  std::mutex wake_mutex_;
+  std::condition_variable wake_cv_;
+  bool commit_requested_ = false;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+/**
+ * MasstreeWrapper<T> whose insert_value, update_value and remove_value are
+ * logged to a WriteAheadLog. Values are written through a serializer (see
+ * snapshot.hpp); recover() rebuilds the table from the log, with values
+ * made by Serializer::read that belong to the caller like any other (the
+ * tree never frees values). Writes to one
+ * key are ordered by a striped lock held across the tree operation and the
+ * append, so the log sees them in the order the tree applied them. Reads go
+ * straight to the tree. Values must not be nullptr.
+ */
+template <typename T, typename Serializer = TrivialSerializer<T>>
+class DurableMasstreeWrapper : private MasstreeWrapper<T> {
+  using Base = MasstreeWrapper<T>;
+
+public:
+  using Str = typename Base::Str;
+  using leaf_type = typename Base::leaf_type;
+
+  using Base::count_range;
+  using Base::dump_latency;
+  using Base::estimate_range;
+  using Base::find_value;
+  using Base::get_value;
+  using Base::latency_histograms;
+  using Base::multi_get;
+  using Base::quiesce;
+  using Base::reclaim_stats;
+  using Base::reset_latency;
+  using Base::rscan;
+  using Base::scan;
+  using Base::interleave_internodes;
+  using Base::start_reclamation;
+  using Base::stats;
+  using Base::stop_reclamation;
+  using Base::thread_init;
+  using Base::thread_offline;
+
+  explicit DurableMasstreeWrapper(WalOptions options = WalOptions(),
+                                  Serializer ser = Serializer())
+      : log_(std::move(options)), ser_(std::move(ser)) {}
+
+  bool insert_value(const char *key, std::size_t len_key, T *value) {
+    std::vector<char> &bytes = serialize(value);
+    WriteAheadLog::Ticket ticket;
+    {
+      std::lock_guard<std::mutex> lk(stripe(key, len_key));
+      if (!Base::insert_value(key, len_key, value))
+        return 0;
+      ticket = log_.append(key, len_key, bytes.data(), bytes.size());
+    }
+    log_.wait(ticket);
+    return 1;
+  }
+
+  bool update_value(const char *key, std::size_t len_key, T *value) {
+    std::vector<char> &bytes = serialize(value);
+    WriteAheadLog::Ticket ticket;
+    {
+      std::lock_guard<std::mutex> lk(stripe(key, len_key));
+      if (!Base::update_value(key, len_key, value))
+        return 0;
+      ticket = log_.append(key, len_key, bytes.data(), bytes.size());
+    }
+    log_.wait(ticket);
+    return 1;
+  }
+
+  bool remove_value(const char *key, std::size_t len_key) {
+    WriteAheadLog::Ticket ticket;
+    {
+      std::lock_guard<std::mutex> lk(stripe(key, len_key));
+      if (!Base::remove_value(key, len_key))
+        return 0;
+      ticket = log_.append(key, len_key, nullptr, 0);
+    }
+    log_.wait(ticket);
+    return 1;
+  }
+
+  /**
+   * Replays the log into the table (normally empty, or loaded with
+   * load_checkpoint()) in num_threads key ranges on the scan workers. Call
+   * it before any other use of the table: values it replaces or removes
+   * came from Serializer::read as well and are released on the spot.
+   */
+  WalReplayInfo recover(std::size_t num_threads = 1) {
+    return log_.replay(
+        num_threads,
+        [this](std::string_view key, const char *value,
+               std::size_t len_value) -> const char * {
+          T *old_value;
+          if (value == nullptr) {
+            if (Base::remove_value_and_get_old(key.data(), key.size(),
+                                               old_value))
+              ser_.release(old_value);
+            return nullptr;
+          }
+          T *v = ser_.read(value, len_value);
+          if (v == nullptr)
+            return "value does not deserialize";
+          if (!Base::upsert_and_get_old(key.data(), key.size(), v, old_value))
+            ser_.release(old_value);
+          return nullptr;
+        },
+        [this](std::size_t jobs, const std::function<void(std::size_t)> &job) {
+          Base::run_on_workers(jobs, job);
+        });
+  }
+
+  /**
+   * Saves a snapshot of the table to path (see snapshot.hpp) and deletes
+   * the log segments it makes redundant, so replay time stays bounded.
+   * Writers keep going meanwhile. After a restart, load_checkpoint(path)
+   * and then recover() restore the table.
+   */
+  SnapshotInfo checkpoint(const std::string &path) {
+    unsigned segment = log_.cut();
+    SnapshotInfo info = save_snapshot(static_cast<Base &>(*this), path, ser_);
+    if (!info)
+      return info;
+    // the rename into path must be durable before the log goes
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0)
+      close(fd);
+    if (!synced) {
+      info.error = "cannot sync the directory of " + path;
+      return info;
+    }
+    log_.truncate(segment);
+    return info;
+  }
+
+  // loads a checkpoint into the empty table; recover() must follow
+  SnapshotInfo load_checkpoint(const std::string &path,
+                               std::size_t num_threads = 1) {
+    return load_snapshot(static_cast<Base &>(*this), path, ser_, num_threads);
+  }
+
+  // commits every append so far (for asynchronous logs)
+  void flush_log() { log_.flush(); }
+
+  WriteAheadLog::Stats log_stats() { return log_.stats(); }
+
+private:
+  static constexpr std::size_t num_stripes = 256;
+
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  std::mutex &stripe(const char *key, std::size_t len_key) {
+    std::size_t h =
+        std::hash<std::string_view>()(std::string_view(key, len_key));
+    return stripes_[h % num_stripes].mutex;
+  }
+
+  // serialized outside the stripe lock, into a per-thread scratch buffer
+  std::vector<char> &serialize(const T *value) {
+    assert(value != nullptr);
+    thread_local std::vector<char> bytes;
+    bytes.resize(ser_.size(*value));
+    ser_.write(*value, bytes.data());
+    return bytes;
+  }
+
+  WriteAheadLog log_;
+  Serializer ser_;
+  Stripe stripes_[num_stripes];
+};
@@ -7,6 +7,12 @@ NUM_KEYS=1000001
 KEY_SIZE=101
 VAL_MIN_SIZE=51
 VAL_MAX_SIZE=101
+VALUE_MODE=borrowed
+# none, compact or scatter; INTERNODES=interleave spreads internodes over nodes
+AFFINITY=${AFFINITY:-none}
+INTERNODES=${INTERNODES:-local}
+# PERF_COUNTERS=1 adds cycles, instructions and cache, TLB and branch misses
+# per operation for each thread (read by the benchmark from the environment)
 
 # Threads to test
 THREADS=(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20)
@@ -23,7 +29,7 @@ for t in "${THREADS[@]}"; do
     echo "Running with $t thread(s)..." > "$output_file"
     for i in $(seq 1 $RUNS); do
         echo "Run $i:" >> "$output_file"
-        $BINARY "$t" "$NUM_KEYS" "$KEY_SIZE" "$VAL_MIN_SIZE" "$VAL_MAX_SIZE" >> "$output_file"
+        $BINARY "$t" "$NUM_KEYS" "$KEY_SIZE" "$VAL_MIN_SIZE" "$VAL_MAX_SIZE" "$VALUE_MODE" "$AFFINITY" "$INTERNODES" >> "$output_file"
     done
     echo "-----------------------------" >> "$output_file"
 done
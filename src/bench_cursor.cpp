@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+
+// Pages through the whole table, page by page, the way an API paginates:
+// once by restarting scan() after the last key of the previous page, once
+// with a Cursor kept between pages. Keys get a shared prefix of the given
+// length, so long prefixes put every key in deeper layers. Checks both see
+// the same keys, and that walking back with prev() retraces them.
+//
+// usage: bench_cursor [keys] [page size] [key prefix bytes]
+
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+struct PageVisitor {
+  std::string last;
+  uint64_t rows = 0;
+  uint64_t sum = 0;
+  void per_kv(const MT::Str &key, const ValueType *val, bool &) {
+    last.assign(key.s, key.len);
+    ++rows;
+    sum += *val;
+  }
+};
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+  std::size_t page = argc > 2 ? std::stoul(argv[2]) : 50;
+  std::size_t prefix_len = argc > 3 ? std::stoul(argv[3]) : 0;
+
+  MT mt;
+  mt.thread_init(0);
+  std::vector<ValueType> values(num_keys);
+  std::string key(prefix_len, 'p');
+  Xoshiro256PlusPlus rng(1);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    values[i] = rng();
+    uint64_t id = __builtin_bswap64(values[i]);
+    key.resize(prefix_len);
+    key.append(reinterpret_cast<const char *>(&id), sizeof(id));
+    mt.insert_value(key.data(), key.size(), &values[i]);
+  }
+
+  auto measure = [&](const char *title, uint64_t rows, uint64_t sum,
+                     std::chrono::steady_clock::time_point start) {
+    double sec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    printf("%-16s %8.1f ms %8.2f Mrows/s %zu rows, sum %016lx\n", title,
+           sec * 1e3, rows / sec / 1e6, static_cast<std::size_t>(rows),
+           static_cast<unsigned long>(sum));
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t scan_rows = 0, scan_sum = 0;
+  std::string last;
+  for (bool first = true;; first = false) {
+    PageVisitor v;
+    mt.scan(first ? "" : last.data(), first ? 0 : last.size(), !first,
+            nullptr, 0, false, v, page);
+    scan_rows += v.rows;
+    scan_sum += v.sum;
+    if (v.rows < page)
+      break;
+    last = v.last;
+  }
+  measure("scan restarts", scan_rows, scan_sum, start);
+
+  start = std::chrono::steady_clock::now();
+  uint64_t cursor_rows = 0, cursor_sum = 0;
+  MT::Cursor cursor = mt.cursor();
+  cursor.seek_to_first();
+  while (cursor.valid()) {
+    std::size_t n = 0;
+    for (auto [k, v] : cursor) {
+      (void)k;
+      cursor_sum += *v;
+      if (++n == page)
+        break;
+    }
+    cursor_rows += n;
+    if (n == page)
+      cursor.next();
+  }
+  measure("cursor", cursor_rows, cursor_sum, start);
+
+  // walk the last pages backwards and forwards again
+  std::vector<std::string> forward, backward;
+  std::string max_key(prefix_len, 'p');
+  max_key.append(8, '\xff');
+  cursor.seek_for_prev(max_key.data(), max_key.size());
+  for (std::size_t i = 0; i < 3 * page && cursor.valid(); ++i, cursor.prev())
+    backward.emplace_back(cursor.key());
+  cursor.seek(backward.back().data(), backward.back().size());
+  for (std::size_t i = 0; i < backward.size() && cursor.valid();
+       ++i, cursor.next())
+    forward.emplace_back(cursor.key());
+  bool retraced = std::equal(forward.rbegin(), forward.rend(),
+                             backward.begin(), backward.end());
+
+  bool ok = scan_rows == num_keys && cursor_rows == scan_rows &&
+            cursor_sum == scan_sum && retraced;
+  printf("%s\n", ok ? "cursor and scan agree" : "MISMATCH");
+  return ok ? 0 : 1;
+}
@@ -1,9 +1,13 @@
 #include <chrono>
 #include <cstdio>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 #define GLOBAL_VALUE_DEFINE
 #include "masstree_wrapper.hpp"
+#include "owning_masstree_wrapper.hpp"
+#include "perf_counters.hpp"
 #include "random.hpp"
 #include "utils.hpp"
 
@@ -102,16 +106,23 @@ void measure_time(const char *title, const std::function<void()> &f)
            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
 }
 
-void run_insertion_test(MT& mt, const std::vector<RandomKVs>& partitions) {
+void run_insertion_test(MT& mt, const std::vector<RandomKVs>& partitions,
+                        CpuAffinity affinity = CpuAffinity::none,
+                        PerfPhase* perf = nullptr) {
     std::vector<std::thread> threads;
   
-    auto insert_partition = [&mt](const RandomKVs& partition, size_t thread_id) {
-      mt.thread_init(thread_id);  // Crucial step!
+    auto insert_partition = [&mt, affinity, perf](const RandomKVs& partition, size_t thread_id) {
+      mt.thread_init(thread_id, affinity);  // Crucial step!
+      PerfCounters counters;
+      counters.start();
       for (const auto& [key, val] : partition.kvs) {
         // Make a proper copy of the value into Masstree storage
         // auto val_copy = new std::vector<uint8_t>(val);
         mt.insert_value(reinterpret_cast<const char*>(key.data()), key.size(), const_cast<std::vector<uint8_t>*>(&val));
       }
+      if (perf) {
+        perf->add(thread_id, counters.stop(partition.kvs.size()));
+      }
     };
   
     for (size_t i = 0; i < partitions.size(); ++i) {
@@ -123,6 +134,67 @@ void run_insertion_test(MT& mt, const std::vector<RandomKVs>& partitions) {
     }
 }
 
+// same as run_insertion_test, but the tree copies each value into its own
+// per-thread pools instead of borrowing a pointer into the partition
+void run_owning_insertion_test(OwningMasstreeWrapper& mt, const std::vector<RandomKVs>& partitions,
+                               CpuAffinity affinity = CpuAffinity::none,
+                               PerfPhase* perf = nullptr) {
+    std::vector<std::thread> threads;
+
+    auto insert_partition = [&mt, affinity, perf](const RandomKVs& partition, size_t thread_id) {
+      mt.thread_init(thread_id, affinity);
+      PerfCounters counters;
+      counters.start();
+      for (const auto& [key, val] : partition.kvs) {
+        mt.insert_value(reinterpret_cast<const char*>(key.data()), key.size(),
+                        ByteView{reinterpret_cast<const char*>(val.data()), val.size()});
+      }
+      if (perf) {
+        perf->add(thread_id, counters.stop(partition.kvs.size()));
+      }
+    };
+
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      threads.emplace_back(insert_partition, std::cref(partitions[i]), i);
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+}
+
+using BatchInput = std::vector<std::pair<std::string_view, std::vector<uint8_t>*>>;
+
+// same as run_insertion_test, but each thread hands its (sorted) partition
+// to insert_batch batch_size keys at a time
+void run_batch_insertion_test(MT& mt, const std::vector<BatchInput>& inputs,
+                              size_t batch_size,
+                              CpuAffinity affinity = CpuAffinity::none,
+                              PerfPhase* perf = nullptr) {
+    std::vector<std::thread> threads;
+
+    auto insert_partition = [&mt, batch_size, affinity, perf](const BatchInput& input, size_t thread_id) {
+      mt.thread_init(thread_id, affinity);
+      PerfCounters counters;
+      counters.start();
+      for (size_t i = 0; i < input.size(); i += batch_size) {
+        size_t end = std::min(input.size(), i + batch_size);
+        mt.insert_batch(input.begin() + i, input.begin() + end);
+      }
+      if (perf) {
+        perf->add(thread_id, counters.stop(input.size()));
+      }
+    };
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      threads.emplace_back(insert_partition, std::cref(inputs[i]), i);
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+}
+
 void verify_insertion(MT &mt, const std::vector<RandomKVs> &partitions)
 {
     size_t missing = 0;
@@ -153,17 +225,87 @@ int main(int argc, char** argv) {
     size_t key_size = argc > 3 ? std::stoul(argv[3]) : 100;
     size_t val_min_size = argc > 4 ? std::stoul(argv[4]) : 50;
     size_t val_max_size = argc > 5 ? std::stoul(argv[5]) : 100;
-  
-    MT mt;
+    // "borrowed" stores pointers to the caller's values, "owning" copies them,
+    // "bulk" builds the tree bottom-up from one sorted partition, "batch"
+    // inserts sorted partitions key by key and then with insert_batch
+    std::string value_mode = argc > 6 ? argv[6] : "borrowed";
+    bool bulk = (value_mode == "bulk");
+    bool batch = (value_mode == "batch");
+    // none, compact or scatter; "interleave" also spreads internodes over
+    // the NUMA nodes
+    CpuAffinity affinity = parse_cpu_affinity(argc > 7 ? argv[7] : "none");
+    bool interleave = argc > 8 && std::string(argv[8]) == "interleave";
+    if (interleave && !MT::interleave_internodes()) {
+      printf("internodes not interleaved: single node or no mbind\n");
+    }
   
     printf("Generating random key-value pairs with %zu threads and %zu keys\n", num_threads, num_keys);
+    printf("%zu NUMA node(s), cpu affinity %s\n", NumaTopology::get().nodes(), cpu_affinity_name(affinity));
   
     auto kv_partitions = RandomKVs::generate(
-        true, false, num_threads, num_keys, key_size, val_min_size, val_max_size);
+        true, bulk || batch, bulk ? 1 : num_threads, num_keys, key_size, val_min_size, val_max_size);
   
-    measure_time("Masstree Parallel Insertion", [&]() {
-      run_insertion_test(mt, kv_partitions);
-    });
+    if (bulk) {
+      MT mt;
+      std::vector<std::pair<std::string_view, std::vector<uint8_t>*>> input;
+      for (const auto& [key, val] : kv_partitions[0].kvs) {
+        input.emplace_back(std::string_view(reinterpret_cast<const char*>(key.data()), key.size()),
+                           const_cast<std::vector<uint8_t>*>(&val));
+      }
+      PerfPhase perf("bulk load (all threads)");
+      measure_time("Masstree Bulk Load", [&]() {
+        // the loader's threads are counted as they exit
+        PerfCounters counters(true);
+        counters.start();
+        mt.bulk_load(input.begin(), input.end(), 1.0, num_threads);
+        perf.add(0, counters.stop(input.size()));
+      });
+      perf.print(stdout);
+      verify_insertion(mt, kv_partitions);
+    } else if (batch) {
+      // keys in order within each thread, as a time-ordered ingest sends them
+      const size_t batch_size = 1024;
+      std::vector<BatchInput> inputs(kv_partitions.size());
+      for (size_t i = 0; i < kv_partitions.size(); ++i) {
+        for (const auto& [key, val] : kv_partitions[i].kvs) {
+          inputs[i].emplace_back(std::string_view(reinterpret_cast<const char*>(key.data()), key.size()),
+                                 const_cast<std::vector<uint8_t>*>(&val));
+        }
+      }
+      {
+        MT mt;
+        PerfPhase perf("insert (sorted, per key)");
+        measure_time("Masstree Parallel Insertion (sorted, per key)", [&]() {
+          run_insertion_test(mt, kv_partitions, affinity, &perf);
+        });
+        perf.print(stdout);
+      }
+      MT mt;
+      PerfPhase perf("insert_batch");
+      measure_time("Masstree Parallel Insertion (insert_batch)", [&]() {
+        run_batch_insertion_test(mt, inputs, batch_size, affinity, &perf);
+      });
+      perf.print(stdout);
+      verify_insertion(mt, kv_partitions);
+    } else if (value_mode == "owning") {
+      OwningMasstreeWrapper mt;
+      PerfPhase perf("insert (owning)");
+      measure_time("Masstree Parallel Insertion (owning)", [&]() {
+        run_owning_insertion_test(mt, kv_partitions, affinity, &perf);
+      });
+      perf.print(stdout);
+    } else {
+      MT mt;
+      PerfPhase perf("insert");
+      measure_time("Masstree Parallel Insertion", [&]() {
+        run_insertion_test(mt, kv_partitions, affinity, &perf);
+      });
+      perf.print(stdout);
+    }
+    printf("RSS: %.1f MB\n", rss_bytes() / 1e6);
+    if (LatencyRecorder::enabled) {
+      LatencyRecorder::dump(stdout);
+    }
   
     printf("Done.\n");
   
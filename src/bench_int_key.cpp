@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "int_key_masstree_wrapper.hpp"
+#include "masstree_wrapper.hpp"
+#include "utils.hpp"
+
+// uint64_t keys through the byte-key API (bswap boilerplate at the call
+// site) and through IntKeyMasstreeWrapper.
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+using IMT = IntKeyMasstreeWrapper<ValueType, KeyType>;
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 5'000'000;
+  std::size_t scan_len = argc > 2 ? std::stoull(argv[2]) : 1'000;
+
+  std::vector<KeyType> keys(num_keys);
+  std::vector<ValueType> values(num_keys);
+  Permutation perm(0, num_keys - 1);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    keys[i] = perm[i];
+    values[keys[i]] = keys[i];
+  }
+
+  printf("keys: %zu\n", num_keys);
+  {
+    MT mt;
+    mt.thread_init(0);
+    measure_mops("bytes insert", num_keys, [&] {
+      for (KeyType k : keys) {
+        KeyType key_buf{__builtin_bswap64(k)};
+        mt.insert_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf),
+                        &values[k]);
+      }
+    });
+    measure_mops("bytes get", num_keys, [&] {
+      for (KeyType k : keys) {
+        KeyType key_buf{__builtin_bswap64(k)};
+        always_assert(mt.get_value(reinterpret_cast<char *>(&key_buf),
+                                   sizeof(key_buf)) != nullptr);
+      }
+    });
+    uint64_t key_sum = 0;
+    measure_mops("bytes scan", num_keys / scan_len * scan_len, [&] {
+      for (KeyType l = 0; l + scan_len <= num_keys; l += scan_len) {
+        KeyType l_key_buf{__builtin_bswap64(l)};
+        KeyType r_key_buf{__builtin_bswap64(l + scan_len - 1)};
+        mt.scan(reinterpret_cast<char *>(&l_key_buf), sizeof(KeyType), false,
+                reinterpret_cast<char *>(&r_key_buf), sizeof(KeyType), false,
+                {[](const MT::leaf_type *, uint64_t, bool &) {},
+                 [&key_sum](const MT::Str &key, const ValueType *, bool &) {
+                   key_sum += __builtin_bswap64(
+                       *reinterpret_cast<const uint64_t *>(key.s));
+                 }});
+      }
+    });
+    printf("key sum: %lu\n", key_sum);
+  }
+  {
+    IMT mt;
+    mt.thread_init(0);
+    measure_mops("typed insert", num_keys, [&] {
+      for (KeyType k : keys)
+        mt.insert_value(k, &values[k]);
+    });
+    measure_mops("typed get", num_keys, [&] {
+      for (KeyType k : keys)
+        always_assert(mt.get_value(k) != nullptr);
+    });
+    CountVisitor v;
+    measure_mops("typed scan", num_keys / scan_len * scan_len, [&] {
+      for (KeyType l = 0; l + scan_len <= num_keys; l += scan_len)
+        mt.scan(l, false, l + scan_len - 1, false, v);
+    });
+    printf("key sum: %lu\n", v.sum); // each value is its key
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "key_encoding.hpp"
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+#include "utils.hpp"
+
+// A secondary index keyed by (tenant, status, order id) -> order id, queried
+// by (tenant, status) prefix. Once with keys built in a std::string per
+// query, bswap and successor by hand, once with KeyEncoder and
+// KeyPrefixRange on the stack. Checks both find the same rows and that the
+// index keys decode back to their tuples.
+//
+// usage: bench_key_encoding [rows] [queries] [tenants]
+
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+static const char *const statuses[] = {"cancelled", "open", "paid",
+                                       "shipped"};
+
+// the hand-written form: big-endian tenant, status, a 0 byte, big-endian id
+std::string string_prefix(uint32_t tenant, const char *status) {
+  uint32_t t = __builtin_bswap32(tenant);
+  std::string key(reinterpret_cast<const char *>(&t), sizeof(t));
+  key.append(status);
+  key.push_back('\0');
+  return key;
+}
+
+int main(int argc, char **argv) {
+  std::size_t num_rows = argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+  std::size_t num_queries = argc > 2 ? std::stoull(argv[2]) : 1'000'000;
+  uint32_t num_tenants = argc > 3 ? std::stoul(argv[3]) : 10'000;
+
+  MT strings, encoded;
+  strings.thread_init(0);
+  std::vector<ValueType> ids(num_rows);
+  Xoshiro256PlusPlus rng(1);
+  std::size_t bad_keys = 0;
+  for (std::size_t i = 0; i < num_rows; ++i) {
+    ids[i] = i;
+    uint32_t tenant = rng() % num_tenants;
+    const char *status = statuses[rng() % 4];
+
+    std::string key = string_prefix(tenant, status);
+    uint64_t id = __builtin_bswap64(i);
+    key.append(reinterpret_cast<const char *>(&id), sizeof(id));
+    strings.insert_value(key.data(), key.size(), &ids[i]);
+
+    KeyEncoder<> ek(tenant, status, uint64_t(i));
+    encoded.insert_value(ek.data(), ek.size(), &ids[i]);
+    std::tuple<uint32_t, std::string, uint64_t> back;
+    KeyDecoder d(ek.data(), ek.size());
+    bad_keys += !d.read(back) || back != std::make_tuple(tenant, status, i);
+  }
+
+  std::vector<std::pair<uint32_t, const char *>> queries(num_queries);
+  for (auto &q : queries)
+    q = {static_cast<uint32_t>(rng() % num_tenants), statuses[rng() % 4]};
+
+  CountVisitor by_string;
+  measure_mops(
+      "std::string keys", num_queries,
+      [&] {
+        for (const auto &q : queries) {
+          std::string lkey = string_prefix(q.first, q.second);
+          std::string rkey = lkey;
+          ++rkey.back(); // the status ends in 0, so this is its successor
+          strings.scan(lkey.data(), lkey.size(), false, rkey.data(),
+                       rkey.size(), true, by_string);
+        }
+      },
+      "queries");
+
+  CountVisitor by_encoder;
+  measure_mops(
+      "KeyEncoder", num_queries,
+      [&] {
+        for (const auto &q : queries) {
+          KeyPrefixRange<> r(KeyEncoder<>(q.first, q.second));
+          encoded.scan(r.lkey(), r.len_lkey(), r.l_exclusive(), r.rkey(),
+                       r.len_rkey(), r.r_exclusive(), by_encoder);
+        }
+      },
+      "queries");
+
+  printf("%lu rows per query\n",
+         static_cast<unsigned long>(by_encoder.rows / num_queries));
+  bool ok = bad_keys == 0 && by_string.rows == by_encoder.rows &&
+            by_string.sum == by_encoder.sum;
+  printf("%s\n", ok ? "both find the same rows" : "MISMATCH");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+#include "utils.hpp"
+
+// Batched point lookups on a tree much larger than the LLC: a loop of
+// get_value() against multi_get() over the same random batches.
+
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+std::vector<std::string> make_keys(std::size_t num_keys, std::size_t key_size) {
+  std::vector<std::string> keys(num_keys, std::string(key_size, '\0'));
+  Permutation perm(0, num_keys - 1);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    uint64_t key_buf{__builtin_bswap64(perm[i])};
+    memcpy(&keys[i][0], &key_buf, std::min(sizeof(key_buf), key_size));
+  }
+  return keys;
+}
+
+void load(MT &mt, const std::vector<std::string> &keys,
+          std::vector<ValueType> &values, std::size_t num_threads) {
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      mt.thread_init(t);
+      for (std::size_t i = t; i < keys.size(); i += num_threads)
+        mt.insert_value(keys[i].data(), keys[i].size(), &values[i]);
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+}
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 10'000'000;
+  std::size_t batch_size = argc > 2 ? std::stoul(argv[2]) : 256;
+  std::size_t num_batches = argc > 3 ? std::stoul(argv[3]) : 20'000;
+  std::size_t key_size = argc > 4 ? std::stoul(argv[4]) : 8;
+
+  MT mt;
+  mt.thread_init(0);
+
+  printf("Loading %zu keys of %zu bytes\n", num_keys, key_size);
+  auto keys = make_keys(num_keys, key_size);
+  std::vector<ValueType> values(num_keys);
+  for (std::size_t i = 0; i < num_keys; ++i)
+    values[i] = i;
+  load(mt, keys, values,
+       std::max(1u, std::thread::hardware_concurrency()));
+
+  // every batch reads random keys; a tenth of them are absent
+  std::vector<std::string> misses = make_keys(num_keys / 10 + 1, key_size);
+  for (auto &k : misses)
+    k.push_back('x');
+  std::vector<const char *> batch_keys(batch_size * num_batches);
+  std::vector<std::size_t> batch_lens(batch_size * num_batches);
+  for (std::size_t i = 0; i < batch_keys.size(); ++i) {
+    const std::string &k = urand_int(0, 9) == 0
+                               ? misses[urand_int(0, misses.size() - 1)]
+                               : keys[urand_int(0, num_keys - 1)];
+    batch_keys[i] = k.data();
+    batch_lens[i] = k.size();
+  }
+
+  std::vector<ValueType *> out(batch_size);
+  std::size_t ops = batch_keys.size();
+  std::size_t found_loop = 0;
+  std::size_t found_batch = 0;
+
+  double loop = measure_mops("get_value loop", ops, [&] {
+    for (std::size_t b = 0; b < num_batches; ++b) {
+      for (std::size_t i = 0; i < batch_size; ++i) {
+        std::size_t k = b * batch_size + i;
+        out[i] = mt.get_value(batch_keys[k], batch_lens[k]);
+        found_loop += (out[i] != nullptr);
+      }
+    }
+  });
+  double batched = measure_mops("multi_get", ops, [&] {
+    for (std::size_t b = 0; b < num_batches; ++b) {
+      std::size_t k = b * batch_size;
+      found_batch += mt.multi_get(&batch_keys[k], &batch_lens[k], out.data(),
+                                  batch_size);
+    }
+  });
+
+  always_assert(found_loop == found_batch, "multi_get disagrees with get_value");
+  printf("batch size: %zu, found: %zu/%zu, speedup: %.2fx\n", batch_size,
+         found_batch, ops, batched / loop);
+  return 0;
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+
+// Scan+insert transactions with Silo-style phantom detection, racing against
+// threads that insert and remove keys inside the scanned ranges. A
+// transaction scans a range, inserts a key of its own into it and validates
+// the leaves it read; it aborts (and takes its insert back) if any changed.
+// Reports abort rate and validation cost, recording leaves either in a
+// NodeSet or in a hand-built std::unordered_map.
+//
+// usage: bench_phantom [scan threads] [insert threads] [keys] [scan length]
+//                      [seconds] [nodeset|map]
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+using NodeMap = std::unordered_map<const MT::leaf_type *, uint64_t>;
+
+ValueType global_value = 0;
+
+struct KeyBuf {
+  KeyType buf;
+  explicit KeyBuf(KeyType k) : buf(__builtin_bswap64(k)) {}
+  const char *data() const { return reinterpret_cast<const char *>(&buf); }
+  static constexpr std::size_t size = sizeof(KeyType);
+};
+
+struct CountVisitor {
+  uint64_t rows = 0;
+  void per_kv(const MT::Str &, const ValueType *, bool &) { ++rows; }
+};
+
+// the same bookkeeping as NodeSet, the way callers used to write it
+struct MapVisitor {
+  NodeMap &nodes;
+  bool &conflict;
+  uint64_t rows = 0;
+
+  void per_kv(const MT::Str &, const ValueType *, bool &) { ++rows; }
+  void per_node(const MT::leaf_type *leaf, uint64_t version,
+                bool &continue_flag) {
+    auto it = nodes.find(leaf);
+    if (it == nodes.end()) {
+      nodes.emplace_hint(it, leaf, version);
+    } else if (it->second != version) {
+      conflict = true;
+      continue_flag = false;
+    }
+  }
+};
+
+struct alignas(64) ScanStats {
+  uint64_t commits = 0;
+  uint64_t aborts = 0;
+  uint64_t nodes = 0;
+  uint64_t validate_ns = 0;
+};
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int main(int argc, char **argv) {
+  std::size_t scan_threads = argc > 1 ? std::stoul(argv[1]) : 4;
+  std::size_t insert_threads = argc > 2 ? std::stoul(argv[2]) : 4;
+  std::size_t num_keys = argc > 3 ? std::stoull(argv[3]) : 1'000'000;
+  std::size_t scan_len = argc > 4 ? std::stoul(argv[4]) : 100;
+  std::size_t seconds = argc > 5 ? std::stoul(argv[5]) : 5;
+  std::string mode = argc > 6 ? argv[6] : "nodeset";
+  bool use_map = (mode == "map");
+
+  // even keys are loaded; odd ones come and go
+  MT mt;
+  mt.thread_init(0);
+  mt.start_reclamation();
+  for (KeyType k = 0; k < num_keys; ++k) {
+    KeyBuf key(2 * k);
+    mt.insert_value(key.data(), KeyBuf::size, &global_value);
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> churn{0};
+  std::vector<ScanStats> stats(scan_threads);
+  std::vector<std::thread> threads;
+
+  for (std::size_t t = 0; t < insert_threads; ++t) {
+    threads.emplace_back([&, t] {
+      mt.thread_init(t + scan_threads);
+      Xoshiro256PlusPlus rng(1000 + t);
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        KeyBuf key(2 * (rng() % num_keys) + 1);
+        if (!mt.insert_value(key.data(), KeyBuf::size, &global_value))
+          mt.remove_value(key.data(), KeyBuf::size);
+        ++n;
+      }
+      churn += n;
+      mt.thread_offline();
+    });
+  }
+
+  for (std::size_t t = 0; t < scan_threads; ++t) {
+    threads.emplace_back([&, t] {
+      mt.thread_init(t);
+      Xoshiro256PlusPlus rng(t);
+      MT::NodeSet node_set;
+      NodeMap node_map;
+      ScanStats local;
+      while (!stop.load(std::memory_order_relaxed)) {
+        KeyType first = rng() % (num_keys - scan_len);
+        KeyBuf lkey(2 * first);
+        KeyBuf rkey(2 * (first + scan_len));
+        // odd, so it is not one of the loaded keys
+        KeyBuf own(2 * (first + rng() % scan_len) + 1);
+
+        bool valid;
+        std::size_t nodes;
+        uint64_t validate_start;
+        bool inserted;
+        if (!use_map) {
+          node_set.clear();
+          CountVisitor v;
+          mt.scan(lkey.data(), KeyBuf::size, false, rkey.data(), KeyBuf::size,
+                  true, v, node_set);
+          inserted = mt.insert_value_and_get_nodeinfo_on_success(
+              own.data(), KeyBuf::size, &global_value, node_set);
+          validate_start = now_ns();
+          valid = node_set.validate();
+          nodes = node_set.size();
+        } else {
+          node_map.clear();
+          bool conflict = false;
+          MapVisitor v{node_map, conflict};
+          mt.scan(lkey.data(), KeyBuf::size, false, rkey.data(), KeyBuf::size,
+                  true, v);
+          MT::node_info_t ni;
+          inserted = mt.insert_value_and_get_nodeinfo_on_success(
+              own.data(), KeyBuf::size, &global_value, ni);
+          if (inserted) {
+            auto leaf = static_cast<const MT::leaf_type *>(ni.node);
+            auto it = node_map.find(leaf);
+            if (it != node_map.end()) {
+              if (it->second == ni.old_version)
+                it->second = ni.new_version;
+              else
+                conflict = true;
+            }
+          }
+          validate_start = now_ns();
+          valid = !conflict;
+          for (const auto &e : node_map)
+            valid &= (e.first->full_version_value() == e.second);
+          nodes = node_map.size();
+        }
+        local.validate_ns += now_ns() - validate_start;
+        local.nodes += nodes;
+
+        local.commits += valid;
+        local.aborts += !valid;
+        // take the insert back either way, to keep the table size steady
+        if (inserted)
+          mt.remove_value(own.data(), KeyBuf::size);
+      }
+      stats[t] = local;
+      mt.thread_offline();
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for (auto &t : threads)
+    t.join();
+  mt.stop_reclamation();
+
+  ScanStats total;
+  for (const ScanStats &s : stats) {
+    total.commits += s.commits;
+    total.aborts += s.aborts;
+    total.nodes += s.nodes;
+    total.validate_ns += s.validate_ns;
+  }
+  uint64_t txns = std::max<uint64_t>(1, total.commits + total.aborts);
+  printf("%s: %zu scanners (%zu rows), %zu churners\n", mode.c_str(),
+         scan_threads, scan_len, insert_threads);
+  printf("txns: %.3f M/s, abort rate: %.2f %%\n", txns / 1e6 / seconds,
+         100.0 * total.aborts / txns);
+  printf("leaves per txn: %.1f, validate: %.1f ns per txn, %.2f ns per leaf\n",
+         static_cast<double>(total.nodes) / txns,
+         static_cast<double>(total.validate_ns) / txns,
+         static_cast<double>(total.validate_ns) /
+             std::max<uint64_t>(1, total.nodes));
+  printf("churn: %.3f Mops/s\n", churn / 1e6 / seconds);
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "utils.hpp"
+
+// Sustained insert/remove churn: every thread slides a window of live keys
+// forward through its own key space, so leaves keep emptying on the left and
+// splitting on the right. With reclamation on, RSS should stay flat.
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+ValueType global_value = 0;
+
+bool insert_value(MT &mt, KeyType key) {
+  KeyType key_buf{__builtin_bswap64(key)};
+  return mt.insert_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf),
+                         &global_value);
+}
+
+bool remove_value(MT &mt, KeyType key) {
+  KeyType key_buf{__builtin_bswap64(key)};
+  return mt.remove_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf));
+}
+
+void run_churn(MT &mt, std::size_t thread_id, std::size_t num_threads,
+               std::size_t window, const std::atomic<bool> &stop,
+               std::atomic<uint64_t> &ops) {
+  mt.thread_init(thread_id);
+  auto key_at = [&](uint64_t i) { return i * num_threads + thread_id; };
+
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+  for (; hi < window; ++hi)
+    insert_value(mt, key_at(hi));
+
+  uint64_t local_ops = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    always_assert(remove_value(mt, key_at(lo++)), "key should exist");
+    always_assert(insert_value(mt, key_at(hi++)), "keys should all be unique");
+    if (++local_ops % 4096 == 0)
+      ops.fetch_add(4096, std::memory_order_relaxed);
+  }
+  mt.thread_offline();
+}
+
+int main(int argc, char **argv) {
+  std::size_t num_threads = argc > 1 ? std::stoul(argv[1]) : 4;
+  std::size_t window = argc > 2 ? std::stoul(argv[2]) : 100'000;
+  std::size_t seconds = argc > 3 ? std::stoul(argv[3]) : 10;
+  bool reclaim = argc > 4 ? std::stoul(argv[4]) != 0 : true;
+
+  MT mt;
+  if (reclaim)
+    mt.start_reclamation();
+
+  printf("threads: %zu, live keys per thread: %zu, reclamation: %s\n",
+         num_threads, window, reclaim ? "on" : "off");
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> ops{0};
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < num_threads; ++i)
+    threads.emplace_back(run_churn, std::ref(mt), i, num_threads, window,
+                         std::cref(stop), std::ref(ops));
+
+  printf("%4s %12s %10s %14s %14s %14s\n", "sec", "ops", "rss(MiB)",
+         "retired(KiB)", "reclaimed(KiB)", "pending(KiB)");
+  for (std::size_t sec = 1; sec <= seconds; ++sec) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto st = MT::reclaim_stats();
+    printf("%4zu %12lu %10.1f %14lu %14lu %14lu\n", sec, ops.load(),
+           rss_bytes() / 1048576.0, st.retired_bytes / 1024,
+           st.reclaimed_bytes / 1024, st.pending_bytes() / 1024);
+  }
+
+  stop = true;
+  for (auto &t : threads)
+    t.join();
+
+  auto st = MT::reclaim_stats();
+  printf("epoch advances: %lu, quiesces: %lu\n", st.advances, st.quiesces);
+  printf("Done.\n");
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "utils.hpp"
+
+// Long forward/backward range scans summing values, through the type-erased
+// Callback and through a visitor passed by type; then a full-table sum on one
+// thread against parallel_scan and parallel_scan_ordered.
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 10'000'000;
+  std::size_t scan_len = argc > 2 ? std::stoull(argv[2]) : 100'000;
+  std::size_t num_scans = argc > 3 ? std::stoul(argv[3]) : 200;
+  std::size_t num_workers =
+      argc > 4 ? std::stoul(argv[4])
+               : std::max(1u, std::thread::hardware_concurrency());
+
+  MT mt;
+  mt.thread_init(0);
+
+  std::vector<ValueType> values(num_keys);
+  for (KeyType k = 0; k < num_keys; ++k) {
+    values[k] = k;
+    KeyType key_buf{__builtin_bswap64(k)};
+    mt.insert_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf),
+                    &values[k]);
+  }
+
+  std::vector<KeyType> starts(num_scans);
+  for (auto &s : starts)
+    s = urand_int(0, num_keys - scan_len);
+
+  auto run = [&](bool reverse, bool typed) {
+    uint64_t rows = 0;
+    for (KeyType l : starts) {
+      KeyType l_key_buf{__builtin_bswap64(l)};
+      KeyType r_key_buf{__builtin_bswap64(l + scan_len - 1)};
+      const char *lk = reinterpret_cast<char *>(&l_key_buf);
+      const char *rk = reinterpret_cast<char *>(&r_key_buf);
+      CountVisitor v;
+      if (typed) {
+        if (reverse)
+          mt.rscan(lk, sizeof(KeyType), false, rk, sizeof(KeyType), false, v);
+        else
+          mt.scan(lk, sizeof(KeyType), false, rk, sizeof(KeyType), false, v);
+      } else {
+        MT::Callback cb{
+            [](const MT::leaf_type *, uint64_t, bool &) {},
+            [&v](const MT::Str &key, const ValueType *val,
+                 bool &continue_flag) { v.per_kv(key, val, continue_flag); }};
+        if (reverse)
+          mt.rscan(lk, sizeof(KeyType), false, rk, sizeof(KeyType), false,
+                   std::move(cb));
+        else
+          mt.scan(lk, sizeof(KeyType), false, rk, sizeof(KeyType), false,
+                  std::move(cb));
+      }
+      always_assert(v.rows == scan_len, "scan missed rows");
+      rows += v.rows;
+    }
+    return rows;
+  };
+
+  uint64_t rows = static_cast<uint64_t>(scan_len) * num_scans;
+  printf("keys: %zu, scan length: %zu, scans: %zu\n", num_keys, scan_len,
+         num_scans);
+  double cb =
+      measure_mops("scan Callback", rows, [&] { run(false, false); }, "rows");
+  double vi =
+      measure_mops("scan visitor", rows, [&] { run(false, true); }, "rows");
+  double rcb =
+      measure_mops("rscan Callback", rows, [&] { run(true, false); }, "rows");
+  double rvi =
+      measure_mops("rscan visitor", rows, [&] { run(true, true); }, "rows");
+  printf("visitor speedup: scan %.2fx, rscan %.2fx\n", vi / cb, rvi / rcb);
+
+  mt.start_scan_workers(num_workers);
+  uint64_t expected = 0;
+  double one = measure_mops(
+      "full scan", num_keys,
+      [&] {
+        CountVisitor v;
+        mt.scan(nullptr, 0, false, nullptr, 0, false, v);
+        expected = v.sum;
+      },
+      "rows");
+  double par = measure_mops(
+      "parallel_scan", num_keys,
+      [&] {
+        std::vector<CountVisitor> vs(num_workers);
+        mt.parallel_scan(nullptr, 0, false, nullptr, 0, false, vs);
+        uint64_t sum = 0;
+        for (auto &v : vs)
+          sum += v.sum;
+        always_assert(sum == expected, "parallel_scan disagrees with scan");
+      },
+      "rows");
+  double ord = measure_mops(
+      "parallel_scan_ordered", num_keys,
+      [&] {
+        CountVisitor v;
+        mt.parallel_scan_ordered(nullptr, 0, false, nullptr, 0, false, v);
+        always_assert(v.sum == expected, "parallel_scan_ordered disagrees");
+      },
+      "rows");
+  printf("%zu workers speedup: unordered %.2fx, ordered %.2fx\n", num_workers,
+         par / one, ord / one);
+  return 0;
+}
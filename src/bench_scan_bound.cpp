@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "utils.hpp"
+
+// Long forward/backward scans with the end key compared per row and per
+// leaf, for 8-byte keys and for 100-byte keys (a shared 92-byte prefix and
+// an 8-byte id, so each row compare runs over the whole prefix). Checks that
+// every scan returns its full range either way.
+//
+// usage: bench_scan_bound [keys] [scan length] [scans]
+
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+  std::size_t scan_len = argc > 2 ? std::stoull(argv[2]) : 100'000;
+  std::size_t num_scans = argc > 3 ? std::stoul(argv[3]) : 200;
+
+  std::vector<ValueType> values(num_keys);
+  for (std::size_t k = 0; k < num_keys; ++k)
+    values[k] = k;
+  std::vector<uint64_t> starts(num_scans);
+  for (auto &s : starts)
+    s = urand_int(0, num_keys - scan_len);
+  uint64_t rows = static_cast<uint64_t>(scan_len) * num_scans;
+  printf("keys: %zu, scan length: %zu, scans: %zu\n", num_keys, scan_len,
+         num_scans);
+
+  for (std::size_t key_size : {std::size_t(8), std::size_t(100)}) {
+    std::string prefix(key_size - sizeof(uint64_t), 'p');
+    auto make_key = [&](uint64_t k) {
+      uint64_t id = __builtin_bswap64(k);
+      std::string key = prefix;
+      key.append(reinterpret_cast<const char *>(&id), sizeof(id));
+      return key;
+    };
+
+    MT mt;
+    mt.thread_init(0);
+    for (std::size_t k = 0; k < num_keys; ++k) {
+      std::string key = make_key(k);
+      mt.insert_value(key.data(), key.size(), &values[k]);
+    }
+
+    auto run = [&](bool reverse) {
+      for (uint64_t l : starts) {
+        std::string lk = make_key(l), rk = make_key(l + scan_len - 1);
+        CountVisitor v;
+        if (reverse)
+          mt.rscan(lk.data(), lk.size(), false, rk.data(), rk.size(), false,
+                   v);
+        else
+          mt.scan(lk.data(), lk.size(), false, rk.data(), rk.size(), false, v);
+        always_assert(v.rows == scan_len, "scan missed rows");
+      }
+    };
+
+    printf("%zu-byte keys\n", key_size);
+    double speedup[2];
+    for (int reverse = 0; reverse < 2; ++reverse) {
+      std::string name = reverse ? "rscan" : "scan";
+      mt.set_scan_bound_check(MT::ScanBoundCheck::per_row);
+      double row = measure_mops((name + " per row").c_str(), rows,
+                                [&] { run(reverse); }, "rows");
+      mt.set_scan_bound_check(MT::ScanBoundCheck::per_leaf);
+      double leaf = measure_mops((name + " per leaf").c_str(), rows,
+                                 [&] { run(reverse); }, "rows");
+      speedup[reverse] = leaf / row;
+    }
+    printf("per-leaf speedup: scan %.2fx, rscan %.2fx\n", speedup[0],
+           speedup[1]);
+  }
+  return 0;
+}
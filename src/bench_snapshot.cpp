@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "snapshot.hpp"
+#include "utils.hpp"
+
+// Saves a table of 8-byte keys to a snapshot file, then rebuilds it with
+// load_snapshot and compares that against inserting the same keys one by one.
+//
+// usage: bench_snapshot [keys] [path] [load threads]
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = MasstreeWrapper<ValueType>;
+
+double measure_sec(const char *title, const std::function<void()> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+  printf("%-24s %8.1f ms\n", title, sec * 1e3);
+  return sec;
+}
+
+int main(int argc, char **argv) {
+  std::size_t num_keys = argc > 1 ? std::stoull(argv[1]) : 10'000'000;
+  std::string path = argc > 2 ? argv[2] : "masstree.snapshot";
+  std::size_t num_threads =
+      argc > 3 ? std::stoul(argv[3])
+               : std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<ValueType> values(num_keys);
+  MT src;
+  src.thread_init(0);
+  measure_sec("insert", [&] {
+    for (KeyType k = 0; k < num_keys; ++k) {
+      values[k] = k;
+      KeyType key_buf{__builtin_bswap64(k)};
+      src.insert_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf),
+                       &values[k]);
+    }
+  });
+
+  SnapshotInfo saved;
+  measure_sec("save_snapshot", [&] {
+    saved = save_snapshot(src, path, TrivialSerializer<ValueType>());
+  });
+  if (!saved) {
+    fprintf(stderr, "save failed: %s\n", saved.error.c_str());
+    return 1;
+  }
+  printf("%zu records, %.1f MB\n", static_cast<std::size_t>(saved.records),
+         saved.bytes / 1e6);
+
+  MT dst;
+  SnapshotInfo loaded;
+  measure_sec("load_snapshot", [&] {
+    loaded = load_snapshot(dst, path, TrivialSerializer<ValueType>(),
+                           num_threads);
+  });
+  if (!loaded) {
+    fprintf(stderr, "load failed: %s\n", loaded.error.c_str());
+    return 1;
+  }
+
+  uint64_t mismatches = 0;
+  for (KeyType k = 0; k < num_keys; ++k) {
+    KeyType key_buf{__builtin_bswap64(k)};
+    const ValueType *v =
+        dst.get_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf));
+    mismatches += (v == nullptr || *v != k);
+  }
+  printf("loaded %zu records with %zu threads, %zu mismatches\n",
+         static_cast<std::size_t>(loaded.records), num_threads,
+         static_cast<std::size_t>(mismatches));
+  remove(path.c_str());
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "inline_masstree_wrapper.hpp"
+#include "random.hpp"
+
+// Counter and dedup style writes on inline uint64_t values: insert falling
+// back to update against upsert, and get + compare_and_swap retries against
+// read_modify_write. Every thread hits random keys of a shared key space.
+//
+// usage: bench_upsert [threads] [keys] [ops per thread]
+
+using KeyType = uint64_t;
+using MT = InlineMasstreeWrapper<uint64_t>;
+
+int main(int argc, char **argv) {
+  std::size_t num_threads = argc > 1 ? std::stoul(argv[1]) : 4;
+  std::size_t num_keys = argc > 2 ? std::stoull(argv[2]) : 1'000'000;
+  std::size_t num_ops = argc > 3 ? std::stoull(argv[3]) : 2'000'000;
+
+  // counting: every op adds one to some counter, so the total is known;
+  // returns the increments lost
+  auto run = [&](const char *title, bool counting,
+                 const std::function<void(MT &, const char *)> &op)
+      -> uint64_t {
+    MT mt;
+    mt.thread_init(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        mt.thread_init(t);
+        Xoshiro256PlusPlus rng(t);
+        for (std::size_t i = 0; i < num_ops; ++i) {
+          KeyType key_buf{__builtin_bswap64(rng() % num_keys)};
+          op(mt, reinterpret_cast<const char *>(&key_buf));
+        }
+        mt.thread_offline();
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    double sec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+    uint64_t sum = 0;
+    for (KeyType k = 0; k < num_keys; ++k) {
+      KeyType key_buf{__builtin_bswap64(k)};
+      auto v = mt.get_value(reinterpret_cast<char *>(&key_buf),
+                            sizeof(key_buf));
+      sum += v ? *v : 0;
+    }
+    printf("%-24s %8.3f Mops/s", title, num_threads * num_ops / sec / 1e6);
+    uint64_t lost = counting ? num_threads * num_ops - sum : 0;
+    if (counting)
+      printf(", %lu increments lost", static_cast<unsigned long>(lost));
+    printf("\n");
+    return lost;
+  };
+
+  run("insert, get + update", true, [](MT &mt, const char *key) {
+    // not atomic: two threads may both see the same old count
+    if (mt.insert_value(key, sizeof(KeyType), 1))
+      return;
+    auto old = mt.get_value(key, sizeof(KeyType));
+    mt.update_value(key, sizeof(KeyType), *old + 1);
+  });
+  // the atomic variants must not lose any
+  uint64_t lost = 0;
+  lost += run("get + compare_and_swap", true, [](MT &mt, const char *key) {
+    for (;;) {
+      auto old = mt.get_value(key, sizeof(KeyType));
+      if (!old) {
+        if (mt.insert_value(key, sizeof(KeyType), 1))
+          return;
+        continue;
+      }
+      if (mt.compare_and_swap(key, sizeof(KeyType), *old, *old + 1))
+        return;
+    }
+  });
+  lost += run("read_modify_write", true, [](MT &mt, const char *key) {
+    mt.read_modify_write(key, sizeof(KeyType), [](bool, uint64_t &count) {
+      ++count;
+      return true;
+    });
+  });
+  run("insert, update", false, [](MT &mt, const char *key) {
+    if (!mt.insert_value(key, sizeof(KeyType), 1))
+      mt.update_value(key, sizeof(KeyType), 1);
+  });
+  run("upsert", false, [](MT &mt, const char *key) {
+    mt.upsert(key, sizeof(KeyType), 1);
+  });
+  if (lost != 0)
+    printf("compare_and_swap or read_modify_write lost increments\n");
+  return lost == 0 ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+#include "write_ahead_log.hpp"
+
+// Inserts and updates through DurableMasstreeWrapper with a given group
+// commit interval, reports throughput and the log's commit stats, then
+// recovers the log into a fresh table and checks every key came back.
+//
+// usage: bench_wal [threads] [keys per thread] [commit interval us]
+//                  [sync|async] [wal dir] [recovery threads]
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+using MT = DurableMasstreeWrapper<ValueType>;
+
+int main(int argc, char **argv) {
+  std::size_t num_threads = argc > 1 ? std::stoul(argv[1]) : 4;
+  std::size_t num_keys = argc > 2 ? std::stoull(argv[2]) : 200'000;
+  std::size_t interval_us = argc > 3 ? std::stoul(argv[3]) : 1000;
+  std::string mode = argc > 4 ? argv[4] : "sync";
+  std::string dir = argc > 5 ? argv[5] : "bench_wal.log";
+  std::size_t recovery_threads =
+      argc > 6 ? std::stoul(argv[6])
+               : std::max(1u, std::thread::hardware_concurrency());
+
+  std::filesystem::remove_all(dir);
+  WalOptions options;
+  options.dir = dir;
+  options.commit_interval = std::chrono::microseconds(interval_us);
+  options.synchronous = (mode != "async");
+
+  std::vector<ValueType> values(num_threads * num_keys);
+  {
+    MT mt(options);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        mt.thread_init(t);
+        Xoshiro256PlusPlus rng(t);
+        for (std::size_t i = 0; i < num_keys; ++i) {
+          std::size_t id = t * num_keys + i;
+          values[id] = id;
+          KeyType key_buf{__builtin_bswap64(id)};
+          mt.insert_value(reinterpret_cast<char *>(&key_buf), sizeof(key_buf),
+                          &values[id]);
+          // rewrite an earlier key of this thread now and then
+          if (i % 4 == 3) {
+            std::size_t old = t * num_keys + rng() % (i + 1);
+            KeyType old_buf{__builtin_bswap64(old)};
+            mt.update_value(reinterpret_cast<char *>(&old_buf),
+                            sizeof(old_buf), &values[old]);
+          }
+        }
+        mt.thread_offline();
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    mt.flush_log();
+    double sec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    WriteAheadLog::Stats stats = mt.log_stats();
+    printf("%s, commit interval %zu us: %.3f Mwrites/s\n", mode.c_str(),
+           interval_us, stats.records / sec / 1e6);
+    stats.dump(stdout);
+  }
+
+  MT recovered(options);
+  recovered.thread_init(0);
+  auto start = std::chrono::steady_clock::now();
+  WalReplayInfo replayed = recovered.recover(recovery_threads);
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+  std::size_t mismatches = 0;
+  for (std::size_t id = 0; id < num_threads * num_keys; ++id) {
+    KeyType key_buf{__builtin_bswap64(id)};
+    const ValueType *v = recovered.get_value(
+        reinterpret_cast<char *>(&key_buf), sizeof(key_buf));
+    mismatches += (v == nullptr || *v != id);
+  }
+  printf("recovered %lu keys with %zu threads in %.1f ms, %zu mismatches\n",
+         static_cast<unsigned long>(replayed.keys), recovery_threads,
+         sec * 1e3, mismatches);
+  if (!replayed)
+    printf("recovery failed: %s\n", replayed.error.c_str());
+  std::filesystem::remove_all(dir);
+  return replayed && mismatches == 0 ? 0 : 1;
+}
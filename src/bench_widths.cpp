@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "random.hpp"
+#include "utils.hpp"
+
+// Sweeps leaf and internode widths: for every pair below and every key size,
+// loads the keys in random order, looks them all up, then runs short scans
+// from random keys. Each key starts with a unique 8-byte slice followed by
+// pseudo-random bytes, so longer keys exercise suffix storage rather than
+// extra layers.
+//
+// usage: bench_widths [threads] [keys] [scan length] [key sizes, e.g. 8,101]
+
+using ValueType = uint64_t;
+
+ValueType global_value = 0;
+
+std::vector<std::string> make_keys(std::size_t num_keys,
+                                   std::size_t key_size) {
+  std::vector<std::string> keys(num_keys);
+  Xoshiro256PlusPlus rng(key_size);
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    std::string &key = keys[i];
+    key.resize(key_size);
+    uint64_t slice = __builtin_bswap64(i);
+    std::memcpy(&key[0], &slice, std::min<std::size_t>(8, key_size));
+    for (std::size_t b = 8; b < key_size; ++b)
+      key[b] = static_cast<char>(rng());
+  }
+  // load order, and hence lookup order, is random
+  for (std::size_t i = num_keys; i > 1; --i)
+    std::swap(keys[i - 1], keys[rng() % i]);
+  return keys;
+}
+
+template <typename F>
+double measure_threads(std::size_t num_threads, std::size_t ops, F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < num_threads; ++t)
+    threads.emplace_back([&, t] { f(t); });
+  for (auto &t : threads)
+    t.join();
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+  return ops / sec / 1e6;
+}
+
+template <int LW, int IW>
+void run(const std::vector<std::string> &keys, std::size_t num_threads,
+         std::size_t scan_len) {
+  using MT = MasstreeWrapper<ValueType, LW, IW>;
+  MT mt;
+  mt.thread_init(0);
+  std::size_t n = keys.size();
+  std::size_t per_thread = (n + num_threads - 1) / num_threads;
+
+  double insert = measure_threads(num_threads, n, [&](std::size_t t) {
+    mt.thread_init(t);
+    for (std::size_t i = t * per_thread; i < std::min(n, (t + 1) * per_thread);
+         ++i)
+      mt.insert_value(keys[i].data(), keys[i].size(), &global_value);
+    mt.thread_offline();
+  });
+
+  double get = measure_threads(num_threads, n, [&](std::size_t t) {
+    mt.thread_init(t);
+    std::size_t found = 0;
+    for (std::size_t i = t * per_thread; i < std::min(n, (t + 1) * per_thread);
+         ++i)
+      found += mt.get_value(keys[i].data(), keys[i].size()) != nullptr;
+    if (found != std::min(n, (t + 1) * per_thread) - t * per_thread)
+      printf("leaf %d, internode %d: lost keys\n", LW, IW);
+    mt.thread_offline();
+  });
+
+  std::size_t num_scans = std::max<std::size_t>(1, n / scan_len);
+  uint64_t rows = 0;
+  std::vector<uint64_t> thread_rows(num_threads);
+  double scan = measure_threads(num_threads, num_scans, [&](std::size_t t) {
+    mt.thread_init(t);
+    Xoshiro256PlusPlus rng(t);
+    CountVisitor v;
+    for (std::size_t i = t; i < num_scans; i += num_threads) {
+      const std::string &l = keys[rng() % n];
+      mt.scan(l.data(), l.size(), false, nullptr, 0, false, v,
+              static_cast<int64_t>(scan_len));
+    }
+    thread_rows[t] = v.rows;
+    mt.thread_offline();
+  });
+  for (uint64_t r : thread_rows)
+    rows += r;
+
+  printf("%4d %9d %8zu %10.3f %10.3f %10.3f %10.3f\n", LW, IW, keys[0].size(),
+         insert, get, scan, scan * rows / num_scans);
+}
+
+template <int LW, int... IWs>
+void run_internodes(const std::vector<std::string> &keys,
+                    std::size_t num_threads, std::size_t scan_len) {
+  (run<LW, IWs>(keys, num_threads, scan_len), ...);
+}
+
+int main(int argc, char **argv) {
+  std::size_t num_threads = argc > 1 ? std::stoul(argv[1]) : 1;
+  std::size_t num_keys = argc > 2 ? std::stoull(argv[2]) : 1'000'000;
+  std::size_t scan_len = argc > 3 ? std::stoul(argv[3]) : 100;
+  std::string sizes = argc > 4 ? argv[4] : "8,16,64,101";
+
+  std::vector<std::size_t> key_sizes;
+  for (std::size_t pos = 0; pos < sizes.size();) {
+    std::size_t comma = std::min(sizes.find(',', pos), sizes.size());
+    key_sizes.push_back(std::stoul(sizes.substr(pos, comma - pos)));
+    pos = comma + 1;
+  }
+
+  printf("leaf internode  key len  insert M/s    get M/s   scan M/s  "
+         "rows M/s\n");
+  for (std::size_t key_size : key_sizes) {
+    std::vector<std::string> keys = make_keys(num_keys, key_size);
+    run_internodes<10, 8, 15, 31, 63>(keys, num_threads, scan_len);
+    run_internodes<12, 8, 15, 31, 63>(keys, num_threads, scan_len);
+    run_internodes<15, 8, 15, 31, 63>(keys, num_threads, scan_len);
+  }
+  return 0;
+}
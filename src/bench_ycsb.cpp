@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLOBAL_VALUE_DEFINE
+#include "masstree_wrapper.hpp"
+#include "owning_masstree_wrapper.hpp"
+#include "random.hpp"
+#include "utils.hpp"
+#include "zipf.hpp"
+
+// YCSB-style mixed workloads (A-F or a custom mix) over a loaded tree, with
+// uniform, zipfian or latest key choice. Threads run a warmup, then a fixed
+// measured period; throughput is reported per thread and per operation type.
+//
+// usage: bench_ycsb [workload] [distribution] [threads] [records] [seconds]
+//                   [warmup seconds] [theta] [key size] [value size]
+//                   [max scan length] [cpu affinity] [internodes]
+//   workload:     A-F, or read,update,insert,scan,rmw percentages
+//                 (e.g. 50,0,0,0,50)
+//   distribution: uniform, zipfian, latest, or default (the workload's own)
+//   cpu affinity: none, compact or scatter (see numa_placement.hpp)
+//   internodes:   local, or interleave over the NUMA nodes
+
+using MT = OwningMasstreeWrapper;
+
+enum Op { READ, UPDATE, INSERT, SCAN, RMW, NUM_OPS };
+const char *const op_names[NUM_OPS] = {"read", "update", "insert", "scan",
+                                       "rmw"};
+
+enum class Distribution { UNIFORM, ZIPFIAN, LATEST };
+
+struct Workload {
+  unsigned ratio[NUM_OPS] = {}; // percentages, summing to 100
+  Distribution dist = Distribution::ZIPFIAN;
+};
+
+Workload make_workload(const std::string &name) {
+  Workload w;
+  auto set = [&w](unsigned r, unsigned u, unsigned i, unsigned s, unsigned m) {
+    w.ratio[READ] = r;
+    w.ratio[UPDATE] = u;
+    w.ratio[INSERT] = i;
+    w.ratio[SCAN] = s;
+    w.ratio[RMW] = m;
+  };
+  if (name == "A") {
+    set(50, 50, 0, 0, 0);
+  } else if (name == "B") {
+    set(95, 5, 0, 0, 0);
+  } else if (name == "C") {
+    set(100, 0, 0, 0, 0);
+  } else if (name == "D") {
+    set(95, 0, 5, 0, 0);
+    w.dist = Distribution::LATEST;
+  } else if (name == "E") {
+    set(0, 0, 5, 95, 0);
+  } else if (name == "F") {
+    set(50, 0, 0, 0, 50);
+  } else {
+    unsigned r[NUM_OPS] = {};
+    if (sscanf(name.c_str(), "%u,%u,%u,%u,%u", &r[READ], &r[UPDATE],
+               &r[INSERT], &r[SCAN], &r[RMW]) != NUM_OPS)
+      throw std::runtime_error("unknown workload: " + name);
+    set(r[READ], r[UPDATE], r[INSERT], r[SCAN], r[RMW]);
+  }
+  unsigned total = 0;
+  for (unsigned r : w.ratio)
+    total += r;
+  if (total != 100)
+    throw std::runtime_error("operation ratios must sum to 100");
+  return w;
+}
+
+Distribution parse_distribution(const std::string &name, Distribution dflt) {
+  if (name == "uniform")
+    return Distribution::UNIFORM;
+  if (name == "zipfian")
+    return Distribution::ZIPFIAN;
+  if (name == "latest")
+    return Distribution::LATEST;
+  if (name == "default")
+    return dflt;
+  throw std::runtime_error("unknown distribution: " + name);
+}
+
+// record ids are hashed so that popular records are spread over the key space
+void make_key(uint64_t id, char *out, std::size_t key_size) {
+  uint64_t h = id;
+  h = (h ^ (h >> 33)) * UINT64_C(0xff51afd7ed558ccd);
+  h = (h ^ (h >> 33)) * UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  uint64_t key_buf{__builtin_bswap64(h)};
+  memset(out, 0, key_size);
+  memcpy(out, &key_buf, std::min(sizeof(key_buf), key_size));
+}
+
+struct alignas(64) ThreadStats {
+  uint64_t ops[NUM_OPS] = {};
+  uint64_t found = 0;
+
+  uint64_t total() const {
+    uint64_t sum = 0;
+    for (uint64_t n : ops)
+      sum += n;
+    return sum;
+  }
+};
+
+// scans count rows and touch the first byte of each value
+struct ScanVisitor {
+  uint64_t rows = 0;
+  uint64_t sum = 0;
+  void per_kv(const MT::Str &, const ByteView &val, bool &) {
+    ++rows;
+    sum += val.size != 0 ? static_cast<uint8_t>(val.data[0]) : 0;
+  }
+};
+
+enum Phase { WARMUP, MEASURE, DONE };
+
+int main(int argc, char **argv) {
+  Workload workload = make_workload(argc > 1 ? argv[1] : "A");
+  std::string dist_name = argc > 2 ? argv[2] : "default";
+  std::size_t num_threads = argc > 3 ? std::stoul(argv[3]) : 4;
+  std::size_t num_records = argc > 4 ? std::stoull(argv[4]) : 1'000'000;
+  std::size_t seconds = argc > 5 ? std::stoul(argv[5]) : 10;
+  std::size_t warmup = argc > 6 ? std::stoul(argv[6]) : 2;
+  double theta = argc > 7 ? std::stod(argv[7]) : 0.99;
+  std::size_t key_size = argc > 8 ? std::stoul(argv[8]) : 8;
+  std::size_t value_size = std::max(1ul, argc > 9 ? std::stoul(argv[9]) : 100);
+  std::size_t max_scan_len = argc > 10 ? std::stoul(argv[10]) : 100;
+  CpuAffinity affinity = parse_cpu_affinity(argc > 11 ? argv[11] : "none");
+  bool interleave = argc > 12 && std::string(argv[12]) == "interleave";
+  workload.dist = parse_distribution(dist_name, workload.dist);
+
+  printf("%zu NUMA node(s), cpu affinity %s\n", NumaTopology::get().nodes(),
+         cpu_affinity_name(affinity));
+  if (interleave && !MT::interleave_internodes())
+    printf("internodes not interleaved: single node or no mbind\n");
+
+  MT mt;
+  mt.start_reclamation();
+
+  printf("Loading %zu records (key %zu bytes, value %zu bytes)\n", num_records,
+         key_size, value_size);
+  {
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        mt.thread_init(t, affinity);
+        std::vector<char> key(key_size);
+        std::vector<char> value(value_size, static_cast<char>(t));
+        for (uint64_t id = t; id < num_records; id += num_threads) {
+          make_key(id, key.data(), key_size);
+          mt.insert_value(key.data(), key_size,
+                          ByteView{value.data(), value_size});
+        }
+        mt.thread_offline();
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+
+  // records inserted during the run get ids from num_records upwards
+  std::atomic<uint64_t> next_id{num_records};
+  std::atomic<int> phase{WARMUP};
+  std::vector<ThreadStats> stats(num_threads);
+  double zetan = FastZipf::zeta(num_records, theta);
+
+  auto worker = [&](std::size_t t) {
+    mt.thread_init(t, affinity);
+    Xoshiro256PlusPlus rng(std::random_device{}());
+    FastZipf zipf(rng, theta, num_records, zetan);
+    std::vector<char> key(key_size);
+    std::vector<char> value(value_size, static_cast<char>(t));
+    ThreadStats local;
+
+    auto choose_id = [&]() -> uint64_t {
+      switch (workload.dist) {
+      case Distribution::UNIFORM:
+        return rng() % next_id.load(std::memory_order_relaxed);
+      case Distribution::ZIPFIAN:
+        return std::min<uint64_t>(zipf(), num_records - 1);
+      case Distribution::LATEST: {
+        uint64_t latest = next_id.load(std::memory_order_relaxed) - 1;
+        uint64_t back = zipf();
+        return back > latest ? 0 : latest - back;
+      }
+      }
+      return 0;
+    };
+
+    int cur = WARMUP;
+    while (cur != DONE) {
+      // check the phase every few operations only
+      for (int i = 0; i < 64; ++i) {
+        unsigned dice = rng() % 100;
+        int op = 0;
+        while (dice >= workload.ratio[op]) {
+          dice -= workload.ratio[op];
+          ++op;
+        }
+
+        switch (op) {
+        case READ:
+          make_key(choose_id(), key.data(), key_size);
+          local.found += mt.get_value(key.data(), key_size).has_value();
+          break;
+        case UPDATE:
+          make_key(choose_id(), key.data(), key_size);
+          value[0] = static_cast<char>(rng());
+          local.found +=
+              mt.update_value(key.data(), key_size,
+                              ByteView{value.data(), value_size});
+          break;
+        case INSERT:
+          make_key(next_id.fetch_add(1), key.data(), key_size);
+          local.found += mt.insert_value(key.data(), key_size,
+                                         ByteView{value.data(), value_size});
+          break;
+        case SCAN: {
+          make_key(choose_id(), key.data(), key_size);
+          ScanVisitor v;
+          mt.scan(key.data(), key_size, false, nullptr, 0, false, v,
+                  1 + rng() % max_scan_len);
+          local.found += v.rows;
+          break;
+        }
+        case RMW: {
+          make_key(choose_id(), key.data(), key_size);
+          auto old = mt.get_value(key.data(), key_size);
+          if (old) {
+            // the view dies with our next call into the tree
+            std::size_t n = std::min(old->size, value_size);
+            memcpy(value.data(), old->data, n);
+            value[0] = static_cast<char>(value[0] + 1);
+            local.found += mt.update_value(key.data(), key_size,
+                                           ByteView{value.data(), n});
+          }
+          break;
+        }
+        }
+        local.ops[op] += (cur == MEASURE);
+      }
+      cur = phase.load(std::memory_order_relaxed);
+    }
+    mt.thread_offline();
+    stats[t] = local;
+  };
+
+  printf("Running %s distribution for %zu s after %zu s warmup\n",
+         dist_name.c_str(), seconds, warmup);
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < num_threads; ++t)
+    threads.emplace_back(worker, t);
+  std::this_thread::sleep_for(std::chrono::seconds(warmup));
+  phase = MEASURE;
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  phase = DONE;
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+  for (auto &t : threads)
+    t.join();
+
+  ThreadStats total;
+  for (std::size_t t = 0; t < num_threads; ++t) {
+    printf("thread %zu: %.3f Mops/s\n", t, stats[t].total() / sec / 1e6);
+    for (int op = 0; op < NUM_OPS; ++op)
+      total.ops[op] += stats[t].ops[op];
+  }
+  for (int op = 0; op < NUM_OPS; ++op) {
+    if (workload.ratio[op] != 0)
+      printf("%s: %.3f Mops/s\n", op_names[op], total.ops[op] / sec / 1e6);
+  }
+  printf("total: %.3f Mops/s, RSS: %.1f MB\n", total.total() / sec / 1e6,
+         rss_bytes() / 1e6);
+  mt.stop_reclamation();
+  return 0;
+}
@@ -109,6 +109,21 @@ void rscan_values(MT *mt, KeyType l_key, KeyType r_key, int64_t count = -1) {
   printf("v_cnt: %ld\n", v_cnt);
 }
 
+// the number of rows scan_values would visit, without visiting them
+void count_values(MT *mt, KeyType l_key, KeyType r_key) {
+  KeyType l_key_buf{__builtin_bswap64(l_key)};
+  KeyType r_key_buf{__builtin_bswap64(r_key)};
+
+  std::size_t exact = mt->count_range(
+      reinterpret_cast<char *>(&l_key_buf), sizeof(l_key_buf), false,
+      reinterpret_cast<char *>(&r_key_buf), sizeof(r_key_buf), false);
+  std::size_t estimate = mt->estimate_range(
+      reinterpret_cast<char *>(&l_key_buf), sizeof(l_key_buf), false,
+      reinterpret_cast<char *>(&r_key_buf), sizeof(r_key_buf), false);
+
+  printf("count: %zu, estimate: %zu\n", exact, estimate);
+}
+
 void run_insert(MT *mt) {
   KeyType current_key = 0;
   bool inserted = 0;
@@ -161,10 +176,17 @@ void run_rscan(MT *mt) {
   rscan_values(mt, l_key, r_key, 20);
 }
 
+void run_count(MT *mt) {
+  KeyType l_key = 0;
+  KeyType r_key = 100;
+  count_values(mt, l_key, r_key);
+}
+
 void test_thread(MT *mt, std::size_t thid) {
   mt->thread_init(thid);
   run_insert(mt);
   sleep(1);
+  run_count(mt);
   // run_rscan(mt);
   // run_update(mt);
   // sleep(1);
@@ -189,4 +211,6 @@ int main() {
   for (std::size_t i = 0; i < n_threads; i++) {
     threads[i].join();
   }
+
+  mt.stats().dump(stdout);
 }
\ No newline at end of file
@@ -10,9 +10,7 @@ using KeyType = uint64_t;
 using ValueType = uint64_t;
 using MT = MasstreeWrapper<ValueType>;
 using NodeInfo = MT::node_info_t;
-using NodeMap =
-    std::unordered_map<const MT::node_type *,
-                       uint64_t>; // key: node pointer, value: version
+using NodeSet = MT::NodeSet; // leaves read so far, with their versions
 
 alignas(64) KeyType max_key = 3000;
 KeyType insert_key = 0;
@@ -49,7 +47,7 @@ bool remove_value_with_nodeinfo(MT *mt, KeyType key, NodeInfo &node_info) {
 }
 
 void scan_values_with_nodeinfo(MT *mt, KeyType l_key, KeyType r_key,
-                               int64_t count, NodeMap &node_map) {
+                               int64_t count, NodeSet &node_set) {
   KeyType l_key_buf{__builtin_bswap64(l_key)};
   KeyType r_key_buf{__builtin_bswap64(r_key)};
 
@@ -59,21 +57,15 @@ void scan_values_with_nodeinfo(MT *mt, KeyType l_key, KeyType r_key,
   uint64_t n_cnt = 0;
   uint64_t v_cnt = 0;
 
-  bool exception_caught = false;
-
+  // leaves are recorded in node_set; one seen at a new version ends the scan
   mt->scan(
       reinterpret_cast<char *>(&l_key_buf), sizeof(l_key_buf), l_exclusive,
       reinterpret_cast<char *>(&r_key_buf), sizeof(r_key_buf), r_exclusive,
-      {[&n_cnt, &node_map, &exception_caught](
-           const MT::leaf_type *leaf, uint64_t version, bool &continue_flag) {
-         auto it = node_map.find(leaf);
-         if (it == node_map.end())
-           node_map.emplace_hint(it, leaf, version);
-         else if (it->second != version) {
-           exception_caught = true;
-           continue_flag = false;
-         }
-
+      {[&n_cnt](const MT::leaf_type *leaf, uint64_t version,
+                bool &continue_flag) {
+         (void)leaf;
+         (void)version;
+         (void)continue_flag;
          n_cnt++;
          return;
        },
@@ -87,15 +79,15 @@ void scan_values_with_nodeinfo(MT *mt, KeyType l_key, KeyType r_key,
          (void)continue_flag;
          return;
        }},
-      count);
+      node_set, count);
 
-  printf(exception_caught ? "ABORT\n" : "SUCCESS\n");
+  printf(node_set.conflicted() ? "ABORT\n" : "SUCCESS\n");
   printf("  scan n_cnt: %ld\n", n_cnt);
   printf("  scan v_cnt: %ld\n", v_cnt);
 }
 
 void rscan_values(MT *mt, KeyType l_key, KeyType r_key, int64_t count,
-                  NodeMap &node_map) {
+                  NodeSet &node_set) {
   KeyType l_key_buf{__builtin_bswap64(l_key)};
   KeyType r_key_buf{__builtin_bswap64(r_key)};
 
@@ -105,20 +97,15 @@ void rscan_values(MT *mt, KeyType l_key, KeyType r_key, int64_t count,
   uint64_t n_cnt = 0;
   uint64_t v_cnt = 0;
 
-  bool exception_caught = false;
   mt->rscan(
       reinterpret_cast<char *>(&l_key_buf), sizeof(l_key_buf), l_exclusive,
       reinterpret_cast<char *>(&r_key_buf), sizeof(r_key_buf), r_exclusive,
-      {[&n_cnt, &node_map, &exception_caught](
-           const MT::leaf_type *leaf, uint64_t version, bool &continue_flag) {
+      {[&n_cnt](const MT::leaf_type *leaf, uint64_t version,
+                bool &continue_flag) {
+         (void)leaf;
+         (void)version;
+         (void)continue_flag;
          n_cnt++;
-         auto it = node_map.find(leaf);
-         if (it == node_map.end())
-           node_map.emplace_hint(it, leaf, version);
-         else if (it->second != version) {
-           exception_caught = true;
-           continue_flag = false;
-         }
          return;
        },
        [&v_cnt](const MT::Str &key, const ValueType *val, bool &continue_flag) {
@@ -129,9 +116,9 @@ void rscan_values(MT *mt, KeyType l_key, KeyType r_key, int64_t count,
          (void)val;
          return;
        }},
-      count);
+      node_set, count);
 
-  printf(exception_caught ? "ABORT\n" : "SUCCESS\n");
+  printf(node_set.conflicted() ? "ABORT\n" : "SUCCESS\n");
   printf("  rscan n_cnt: %ld\n", n_cnt);
   printf("  rscan v_cnt: %ld\n", v_cnt);
 }
@@ -153,10 +140,10 @@ void prepare_data(MT *mt) {
 }
 
 // read all the keys in range
-void run_scan(MT *mt, NodeMap &nm) {
+void run_scan(MT *mt, NodeSet &ns) {
   KeyType l_key = 0;
   KeyType r_key = max_key;
-  scan_values_with_nodeinfo(mt, l_key, r_key, -1, nm);
+  scan_values_with_nodeinfo(mt, l_key, r_key, -1, ns);
 }
 
 // insert mid_key (key in the middle of the range)
@@ -183,35 +170,54 @@ void run_update_existing_key(MT *mt, ValueType *value) {
 }
 
 void scan_insert_scan_test() {
-  NodeMap nm;
+  NodeSet ns;
   MT mt;
   mt.thread_init(0);
   printf("preparing data\n");
   prepare_data(&mt);
   printf("prepared data, running 1st scan\n");
-  run_scan(&mt, nm);
+  run_scan(&mt, ns);
   printf("ran 1st scan, inserting value into the middle node\n");
   run_insert_into_the_middle(&mt);
-  printf("inserted, running 2nd scan\n");
-  run_scan(&mt, nm); // Expected: ABORT
+  // validating instead of scanning again detects the same phantom
+  printf("inserted, validate: %s\n", ns.validate() ? "SUCCESS" : "ABORT");
+  printf("running 2nd scan\n");
+  run_scan(&mt, ns); // Expected: ABORT
 }
 
 void scan_update_scan_test() {
-  NodeMap nm;
+  NodeSet ns;
   MT mt;
   mt.thread_init(0);
   printf("preparing data\n");
   prepare_data(&mt);
   printf("prepared data, running 1st scan\n");
-  run_scan(&mt, nm);
+  run_scan(&mt, ns);
   printf("ran 1st scan, updating value of existing key\n");
   auto temp = std::make_unique<ValueType>(2021);
   run_update_existing_key(&mt, temp.get());
   printf("updated and checked update, running 2nd scan\n");
-  run_scan(&mt, nm); // Expected: SUCCESS
+  run_scan(&mt, ns); // Expected: SUCCESS
+}
+
+// a versioned read stays valid until its key's value or leaf changes
+void versioned_read_test() {
+  MT mt;
+  mt.thread_init(0);
+  prepare_data(&mt);
+  KeyType key_buf{__builtin_bswap64(KeyType{1})};
+  const char *key = reinterpret_cast<char *>(&key_buf);
+  MT::VersionStamp stamp;
+  mt.get_value_versioned(key, sizeof(key_buf), stamp);
+  printf("read, still valid: %s\n", MT::still_valid(stamp) ? "yes" : "no");
+  auto temp = std::make_unique<ValueType>(2021);
+  mt.update_value(key, sizeof(key_buf), temp.get());
+  printf("updated, still valid: %s\n",
+         MT::still_valid(stamp) ? "yes" : "no"); // Expected: no
 }
 
 int main() {
   scan_insert_scan_test();
+  versioned_read_test();
   // scan_update_scan_test();
 }
\ No newline at end of file